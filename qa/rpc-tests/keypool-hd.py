@@ -98,6 +98,17 @@ class KeyPoolTest(BitcoinTestFramework):
         assert_equal(wi['keypoolsize_hd_internal'], 100)
         assert_equal(wi['keypoolsize'], 100)
 
+        # a large refill is derived in parallel but still hands out keys in chain order
+        nodes[0].keypoolrefill(1000)
+        wi = nodes[0].getwalletinfo()
+        assert_equal(wi['keypoolsize_hd_internal'], 1000)
+        assert_equal(wi['keypoolsize'], 1000)
+        keypath = nodes[0].validateaddress(nodes[0].getnewaddress())['hdkeypath']
+        first = int(keypath.split('/')[-1])
+        for i in range(1, 10):
+            keypath = nodes[0].validateaddress(nodes[0].getnewaddress())['hdkeypath']
+            assert_equal(keypath, "m/44'/1'/0'/0/" + str(first + i))
+
     def setup_chain(self):
         print("Initializing test directory "+self.options.tmpdir)
         initialize_chain_clean(self.options.tmpdir, 1)
@@ -280,6 +280,22 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(response_header_json_str)
         assert_equal(len(json_obj), 5) #now we should have 5 header objects
 
+        # fetch a range of raw blocks in one response
+        bb_height = self.nodes[0].getblock(bb_hash)['height']
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height)+'/2'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_blocks.status, 200)
+        response_blocks_str = response_blocks.read()
+        assert_equal(response_blocks_str[0:len(response_str)], response_str)
+        assert_greater_than(len(response_blocks_str), len(response_str) + 80)
+
+        # ranges past the tip are truncated, ranges starting past it are not found
+        tip_height = self.nodes[0].getblockcount()
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(tip_height)+'/5'+self.FORMAT_SEPARATOR+"hex", True)
+        assert_equal(response_blocks.status, 200)
+        assert_equal(response_blocks.read().strip(), self.nodes[0].getblock(self.nodes[0].getbestblockhash(), False).encode('ascii'))
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(tip_height+1)+'/1'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_blocks.status, 404)
+
         # do tx test
         tx_hash = block_json_obj['tx'][0]['txid']
         json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx_hash+self.FORMAT_SEPARATOR+"json")
@@ -0,0 +1,76 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+typedef std::set<std::pair<const CWalletTx*, unsigned int> > CoinSet;
+
+// A payment wallet's UTXO pool: mostly odd amounts spread over four orders of
+// magnitude, with a share of round amounts as left by typical customer payments.
+static void BuildCoinPool(CWallet& wallet, std::vector<COutput>& vCoins, int nCoins)
+{
+    for (int i = 0; i < nCoins; i++) {
+        uint32_t nHash = (uint32_t)i * 2654435761U;
+        CAmount nValue;
+        if (nHash % 4 == 0) {
+            static const CAmount vRound[] = {COIN / 10, COIN / 2, COIN, 5 * COIN, 10 * COIN};
+            nValue = vRound[(nHash >> 8) % 5];
+        } else {
+            static const CAmount vScale[] = {CENT / 10, CENT, COIN / 10, COIN};
+            nValue = vScale[(nHash >> 8) % 4] * (1 + (nHash >> 12) % 1000) / 100;
+        }
+
+        CMutableTransaction tx;
+        tx.nLockTime = i; // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = nValue;
+        vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6 * 24, true, true));
+    }
+}
+
+static void CoinSelection(benchmark::State& state, bool fBnB)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    BuildCoinPool(wallet, vCoins, 10000);
+
+    static const CAmount vTargets[] = {3 * CENT, 25 * CENT, 1 * COIN + 12345, 7 * COIN, 40 * COIN + 1};
+    const CAmount nCostOfChange = 546;
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+    unsigned int n = 0;
+
+    LOCK(wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        const CAmount nTarget = vTargets[n++ % 5];
+        if (fBnB) {
+            std::vector<COutput> vCoinsSorted(vCoins);
+            std::sort(vCoinsSorted.begin(), vCoinsSorted.end(), CompareByValue());
+            if (wallet.SelectCoinsBnB(nTarget, nCostOfChange, 1, 6, vCoinsSorted, setCoinsRet, nValueRet))
+                continue;
+        }
+        wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoinsRet, nValueRet);
+    }
+
+    for (unsigned int i = 0; i < vCoins.size(); i++)
+        delete vCoins[i].tx;
+}
+
+static void CoinSelectionKnapsack(benchmark::State& state)
+{
+    CoinSelection(state, false);
+}
+
+static void CoinSelectionBnB(benchmark::State& state)
+{
+    CoinSelection(state, true);
+}
+
+BENCHMARK(CoinSelectionKnapsack);
+BENCHMARK(CoinSelectionBnB);
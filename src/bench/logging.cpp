@@ -0,0 +1,65 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "base58.h"
+#include "key.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+// What CheckPreviousBlockVotes reports for every block: the expected voters
+// and who they voted for, with -debug=mnpayments not given.
+
+static const int nVoters = 10;
+
+static void BuildVoters(std::vector<CPubKey>& vPubKeys, std::vector<CKeyID>& vPayees)
+{
+    for (int i = 0; i < nVoters; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        vPubKeys.push_back(key.GetPubKey());
+        vPayees.push_back(key.GetPubKey().GetID());
+    }
+}
+
+// The report built up front and handed to LogPrint, which drops it
+static void LogVotesUngated(benchmark::State& state)
+{
+    std::vector<CPubKey> vPubKeys;
+    std::vector<CKeyID> vPayees;
+    BuildVoters(vPubKeys, vPayees);
+
+    while (state.KeepRunning()) {
+        std::string debugStr;
+        for (int i = 0; i < nVoters; i++) {
+            debugStr += strprintf("CheckPreviousBlockVotes --   %s - voted for %s\n",
+                                  HexStr(vPubKeys[i]), CBitcoinAddress(vPayees[i]).ToString());
+        }
+        LogPrint("mnpayments", "%s", debugStr);
+    }
+}
+
+// The report only built once LogAcceptCategory says someone will read it
+static void LogVotesGated(benchmark::State& state)
+{
+    std::vector<CPubKey> vPubKeys;
+    std::vector<CKeyID> vPayees;
+    BuildVoters(vPubKeys, vPayees);
+
+    while (state.KeepRunning()) {
+        const bool fLog = LogAcceptCategory("mnpayments");
+        std::string debugStr;
+        for (int i = 0; i < nVoters; i++) {
+            if (!fLog) continue;
+            debugStr += strprintf("CheckPreviousBlockVotes --   %s - voted for %s\n",
+                                  HexStr(vPubKeys[i]), CBitcoinAddress(vPayees[i]).ToString());
+        }
+        if (fLog) LogPrintStr(debugStr);
+    }
+}
+
+BENCHMARK(LogVotesUngated);
+BENCHMARK(LogVotesGated);
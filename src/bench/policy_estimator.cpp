@@ -0,0 +1,63 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/fees.h"
+#include "primitives/transaction.h"
+#include "txmempool.h"
+
+#include <vector>
+
+// A deterministic block/tx trace: every block sees a fixed number of new
+// mempool transactions spread over a wide feerate range, and confirms the
+// higher paying half of what arrived in the previous few blocks.
+struct FeeTraceBlock
+{
+    std::vector<CTxMemPoolEntry> vArrivals;
+    std::vector<CTxMemPoolEntry> vConfirmed;
+};
+
+static void BuildFeeTrace(std::vector<FeeTraceBlock>& vTrace, int nBlocks, int nTxPerBlock)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0;
+    LockPoints lp;
+
+    vTrace.resize(nBlocks);
+    for (int nHeight = 0; nHeight < nBlocks; nHeight++) {
+        for (int i = 0; i < nTxPerBlock; i++) {
+            tx.vin[0].prevout.n = nHeight * nTxPerBlock + i;
+            CAmount nFee = 1000 + ((i * 7919) % nTxPerBlock) * 500;
+            CTxMemPoolEntry entry(tx, nFee, 0, 0, nHeight, true, 0, false, 1, lp);
+            vTrace[nHeight].vArrivals.push_back(entry);
+            int nDelay = 1 + (nTxPerBlock - (i * 7919) % nTxPerBlock) * 4 / nTxPerBlock;
+            if (nHeight + nDelay < nBlocks)
+                vTrace[nHeight + nDelay].vConfirmed.push_back(entry);
+        }
+    }
+}
+
+static void PolicyEstimatorReplay(benchmark::State& state)
+{
+    std::vector<FeeTraceBlock> vTrace;
+    BuildFeeTrace(vTrace, 200, 100);
+
+    while (state.KeepRunning()) {
+        CBlockPolicyEstimator estimator(CFeeRate(1000));
+        for (unsigned int nHeight = 0; nHeight < vTrace.size(); nHeight++) {
+            FeeTraceBlock& block = vTrace[nHeight];
+            estimator.processBlock(nHeight, block.vConfirmed, true);
+            for (unsigned int i = 0; i < block.vConfirmed.size(); i++)
+                estimator.removeTx(block.vConfirmed[i].GetTx().GetHash());
+            for (unsigned int i = 0; i < block.vArrivals.size(); i++)
+                estimator.processTransaction(block.vArrivals[i], true);
+        }
+        estimator.estimateFee(2);
+    }
+}
+
+BENCHMARK(PolicyEstimatorReplay);
@@ -9,15 +9,42 @@
 #include "clientversion.h"
 #include "hash.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 
+#include <map>
+#include <set>
+
 #include <boost/filesystem.hpp>
 
-/** 
+/**
 *   Generic Dumping and Loading
 *   ---------------------------
+*
+*   Objects are stored in an append-only journal.  The serialized object is cut into
+*   content-defined chunks (boundaries depend on the bytes themselves, so inserting or
+*   removing an entry only changes the chunks around it) and every Dump appends just the
+*   chunks that are not in the file yet, followed by a manifest listing the chunks that
+*   make up the current object.  Each record carries a checksum of its payload.  Loading
+*   takes the last complete manifest, so a dump torn by a crash falls back to the
+*   previous one.  Once superseded records take too much of the file, Dump writes a
+*   fresh journal instead of appending, and Compact() does the same in the background.
+*   The index of every journal is kept in memory after it was scanned or written, so
+*   dumps don't reread and rehash the file while nobody else touched it.
+*
+*   Files written in the old single-blob format are still loaded and get converted on
+*   the next Dump.
 */
 
+/** Journal file header, distinguishes the journal from the old single-blob format */
+static const unsigned char FLATDB_JOURNAL_MAGIC[8] = {'f', 'l', 'a', 't', 'j', 'r', 'n', 0x01};
+/** Content-defined chunking limits (bytes) and boundary mask (~8KB average chunks) */
+static const size_t FLATDB_CHUNK_MIN_SIZE = 2 * 1024;
+static const size_t FLATDB_CHUNK_MAX_SIZE = 64 * 1024;
+static const uint64_t FLATDB_CHUNK_MASK = (1 << 13) - 1;
+/** Compact once superseded records take more space than the live object */
+static const int FLATDB_COMPACT_RATIO = 2;
+
 template<typename T>
 class CFlatDB
 {
@@ -33,50 +60,315 @@ private:
         IncorrectFormat
     };
 
+    enum RecordType {
+        RECORD_CHUNK = 'C',
+        RECORD_MANIFEST = 'M'
+    };
+
+    // record type, payload size, payload hash
+    static const long RECORD_HEADER_SIZE = 1 + 4 + 32;
+
+    /** The chunks making up one dumped object, in order */
+    struct CManifest
+    {
+        std::string strMagicMessage;
+        unsigned char pchMessageStart[4];
+        std::vector<uint256> vChunks;
+        uint64_t nDataSize;
+
+        CManifest() : nDataSize(0) { memset(pchMessageStart, 0, sizeof(pchMessageStart)); }
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+            READWRITE(strMagicMessage);
+            READWRITE(FLATDATA(pchMessageStart));
+            READWRITE(vChunks);
+            READWRITE(nDataSize);
+        }
+    };
+
+    /** Where the chunks of a journal live and which manifest is the latest complete one */
+    struct CJournalIndex
+    {
+        std::map<uint256, std::pair<long, uint32_t> > mapChunks; // chunk hash -> (payload offset, size)
+        CManifest manifest;
+        bool fHaveManifest;
+        long nValidSize; // end of the last intact record, anything past it is a torn write
+        long nLiveSize;  // bytes taken by the latest manifest and the chunks it uses
+
+        CJournalIndex() : fHaveManifest(false), nValidSize(0), nLiveSize(0) {}
+
+        /** Whether superseded records take enough of the file to rewrite it */
+        bool NeedsCompaction() const
+        {
+            return fHaveManifest && nValidSize > FLATDB_COMPACT_RATIO * nLiveSize;
+        }
+
+        /** Sum up the records the latest manifest uses, nManifestRecordSize included */
+        void UpdateLiveSize(long nManifestRecordSize)
+        {
+            nLiveSize = nManifestRecordSize;
+            std::set<uint256> setCounted;
+            for (unsigned int i = 0; i < manifest.vChunks.size(); i++) {
+                std::map<uint256, std::pair<long, uint32_t> >::const_iterator it = mapChunks.find(manifest.vChunks[i]);
+                if (it != mapChunks.end() && setCounted.insert(it->first).second)
+                    nLiveSize += RECORD_HEADER_SIZE + it->second.second;
+            }
+        }
+    };
+
+    /** A journal index along with the file state it describes */
+    struct CCachedIndex
+    {
+        uintmax_t nFileSize;
+        std::time_t nTime;
+        CJournalIndex index;
+    };
+
+    static CCriticalSection& GetIndexCacheLock()
+    {
+        static CCriticalSection cs;
+        return cs;
+    }
+
+    static std::map<std::string, CCachedIndex>& GetIndexCache()
+    {
+        static std::map<std::string, CCachedIndex> mapIndexCache;
+        return mapIndexCache;
+    }
+
     boost::filesystem::path pathDB;
     std::string strFilename;
     std::string strMagicMessage;
 
-    bool Write(const T& objToSave)
+    /** Split ssObj into content-defined chunks using a gear rolling hash */
+    static void SplitChunks(const CDataStream& ssObj, std::vector<std::pair<size_t, size_t> >& vChunkRanges)
     {
-        // LOCK(objToSave.cs);
+        static const struct CGearTable {
+            uint64_t table[256];
+            CGearTable() {
+                // splitmix64, the table only has to be fixed and well mixed
+                uint64_t x = 0;
+                for (int i = 0; i < 256; i++) {
+                    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+                    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                    table[i] = z ^ (z >> 31);
+                }
+            }
+        } gear;
+
+        size_t nStart = 0;
+        uint64_t nRolling = 0;
+        for (size_t nPos = 0; nPos < ssObj.size(); nPos++) {
+            nRolling = (nRolling << 1) + gear.table[(unsigned char)ssObj[nPos]];
+            size_t nLen = nPos + 1 - nStart;
+            if ((nLen >= FLATDB_CHUNK_MIN_SIZE && (nRolling & FLATDB_CHUNK_MASK) == 0) || nLen >= FLATDB_CHUNK_MAX_SIZE) {
+                vChunkRanges.push_back(std::make_pair(nStart, nLen));
+                nStart = nPos + 1;
+                nRolling = 0;
+            }
+        }
+        if (nStart < ssObj.size())
+            vChunkRanges.push_back(std::make_pair(nStart, ssObj.size() - nStart));
+    }
 
-        int64_t nStart = GetTimeMillis();
+    static void WriteRecord(CAutoFile& fileout, uint8_t nRecordType, const uint256& hashRecord, const char* pch, uint32_t nSize)
+    {
+        fileout << nRecordType;
+        fileout << nSize;
+        fileout << hashRecord;
+        fileout.write(pch, nSize);
+    }
 
-        // serialize, checksum data up to that point, then append checksum
-        CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-        ssObj << strMagicMessage; // specific magic message for this type of object
-        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-        ssObj << objToSave;
-        uint256 hash = Hash(ssObj.begin(), ssObj.end());
-        ssObj << hash;
+    bool IsJournal()
+    {
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return false;
+        unsigned char pchMagic[sizeof(FLATDB_JOURNAL_MAGIC)];
+        if (fread(pchMagic, 1, sizeof(pchMagic), filein.Get()) != sizeof(pchMagic))
+            return false;
+        return memcmp(pchMagic, FLATDB_JOURNAL_MAGIC, sizeof(pchMagic)) == 0;
+    }
 
-        // open output file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "wb");
-        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-        if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
+    /**
+     * Index the records of the journal.  Chunks whose payload doesn't match their
+     * checksum are left out of the index, so the next dump writes them again.
+     */
+    ReadResult ScanJournal(CAutoFile& filein, CJournalIndex& index)
+    {
+        long nFileSize = boost::filesystem::file_size(pathDB);
+        long nManifestRecordSize = 0;
+
+        if (fseek(filein.Get(), sizeof(FLATDB_JOURNAL_MAGIC), SEEK_SET))
+            return HashReadError;
+        index.nValidSize = sizeof(FLATDB_JOURNAL_MAGIC);
 
-        // Write and commit header, data
         try {
-            fileout << ssObj;
+            std::vector<unsigned char> vchChunk;
+            while (index.nValidSize + RECORD_HEADER_SIZE <= nFileSize) {
+                uint8_t nRecordType;
+                uint32_t nSize;
+                uint256 hashRecord;
+                filein >> nRecordType >> nSize >> hashRecord;
+                long nPayloadPos = index.nValidSize + RECORD_HEADER_SIZE;
+                if (nPayloadPos + (long)nSize > nFileSize)
+                    break; // torn write
+
+                if (nRecordType == RECORD_CHUNK) {
+                    vchChunk.resize(nSize);
+                    filein.read((char *)vchChunk.data(), nSize);
+                    if (Hash(vchChunk.begin(), vchChunk.end()) == hashRecord)
+                        index.mapChunks[hashRecord] = std::make_pair(nPayloadPos, nSize);
+                    else
+                        LogPrintf("%s: Skipping corrupted chunk %s at offset %d in %s\n", __func__, hashRecord.ToString(), nPayloadPos, strFilename);
+                } else if (nRecordType == RECORD_MANIFEST) {
+                    std::vector<unsigned char> vchManifest(nSize);
+                    filein.read((char *)vchManifest.data(), nSize);
+                    if (Hash(vchManifest.begin(), vchManifest.end()) != hashRecord)
+                        break; // torn write
+                    CDataStream ssManifest(vchManifest, SER_DISK, CLIENT_VERSION);
+                    ssManifest >> index.manifest;
+                    index.fHaveManifest = true;
+                    nManifestRecordSize = RECORD_HEADER_SIZE + nSize;
+                } else {
+                    break;
+                }
+                index.nValidSize = nPayloadPos + nSize;
+            }
         }
         catch (std::exception &e) {
-            return error("%s: Serialize or I/O error - %s", __func__, e.what());
+            // a record we could not parse, everything before it is still usable
+            LogPrint("flatdb", "%s: Stopped reading %s at offset %d - %s\n", __func__, strFilename, index.nValidSize, e.what());
         }
-        fileout.fclose();
 
-        LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
-        LogPrintf("     %s\n", objToSave.ToString());
+        if (!index.fHaveManifest)
+            return Ok;
 
-        return true;
+        index.UpdateLiveSize(nManifestRecordSize);
+
+        if (index.manifest.strMagicMessage != strMagicMessage)
+        {
+            error("%s: Invalid magic message", __func__);
+            return IncorrectMagicMessage;
+        }
+        if (memcmp(index.manifest.pchMessageStart, Params().MessageStart(), sizeof(index.manifest.pchMessageStart)))
+        {
+            error("%s: Invalid network magic number", __func__);
+            return IncorrectMagicNumber;
+        }
+
+        return Ok;
     }
 
-    ReadResult Read(T& objToLoad, bool fDryRun = false)
+    /** Remember index for the file as it is on disk now */
+    void CacheIndex(const CJournalIndex& index)
     {
-        //LOCK(objToLoad.cs);
+        boost::system::error_code ec;
+        CCachedIndex cached;
+        cached.nFileSize = boost::filesystem::file_size(pathDB, ec);
+        cached.nTime = boost::filesystem::last_write_time(pathDB, ec);
+        cached.index = index;
+        LOCK(GetIndexCacheLock());
+        if (ec)
+            GetIndexCache().erase(pathDB.string());
+        else
+            GetIndexCache()[pathDB.string()] = cached;
+    }
 
-        int64_t nStart = GetTimeMillis();
+    /** Index the journal, reusing the last scan or write if the file wasn't changed since */
+    ReadResult ScanJournalFile(CJournalIndex& index)
+    {
+        boost::system::error_code ec;
+        uintmax_t nFileSize = boost::filesystem::file_size(pathDB, ec);
+        std::time_t nTime = boost::filesystem::last_write_time(pathDB, ec);
+        if (!ec) {
+            LOCK(GetIndexCacheLock());
+            typename std::map<std::string, CCachedIndex>::const_iterator it = GetIndexCache().find(pathDB.string());
+            if (it != GetIndexCache().end() && it->second.nFileSize == nFileSize && it->second.nTime == nTime) {
+                index = it->second.index;
+                return Ok;
+            }
+        }
+
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+        {
+            error("%s: Failed to open file %s", __func__, pathDB.string());
+            return FileError;
+        }
+        ReadResult readResult = ScanJournal(filein, index);
+        filein.fclose();
+        if (readResult == Ok)
+            CacheIndex(index);
+        return readResult;
+    }
+
+    /** Reassemble the serialized object from the chunks of the latest manifest */
+    ReadResult ReadJournal(std::vector<unsigned char>& vchData)
+    {
+        CJournalIndex index;
+        ReadResult readResult = ScanJournalFile(index);
+        if (readResult != Ok)
+            return readResult;
+        if (!index.fHaveManifest)
+        {
+            error("%s: No complete dump in %s", __func__, strFilename);
+            return IncorrectFormat;
+        }
+
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+        {
+            error("%s: Failed to open file %s", __func__, pathDB.string());
+            return FileError;
+        }
+
+        vchData.resize(index.manifest.nDataSize);
+        uint64_t nDataPos = 0;
+        try {
+            for (unsigned int i = 0; i < index.manifest.vChunks.size(); i++) {
+                std::map<uint256, std::pair<long, uint32_t> >::const_iterator it = index.mapChunks.find(index.manifest.vChunks[i]);
+                if (it == index.mapChunks.end() || nDataPos + it->second.second > vchData.size())
+                {
+                    error("%s: Missing or oversized chunk, data corrupted", __func__);
+                    return IncorrectHash;
+                }
+                if (fseek(filein.Get(), it->second.first, SEEK_SET))
+                    return HashReadError;
+                unsigned char* pchChunk = vchData.data() + nDataPos;
+                filein.read((char *)pchChunk, it->second.second);
+                // verify stored checksum matches input data
+                if (Hash(pchChunk, pchChunk + it->second.second) != it->first)
+                {
+                    error("%s: Checksum mismatch, data corrupted", __func__);
+                    return IncorrectHash;
+                }
+                nDataPos += it->second.second;
+            }
+        }
+        catch (std::exception &e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return HashReadError;
+        }
+        if (nDataPos != vchData.size())
+        {
+            error("%s: Size mismatch, data corrupted", __func__);
+            return IncorrectHash;
+        }
+
+        return Ok;
+    }
+
+    /** Read a file in the old format: one blob with magic values, object and trailing hash */
+    ReadResult ReadLegacy(std::vector<unsigned char>& vchData)
+    {
         // open input file, and associate with CAutoFile
         FILE *file = fopen(pathDB.string().c_str(), "rb");
         CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
@@ -92,7 +384,6 @@ private:
         // Don't try to resize to a negative number if file is small
         if (dataSize < 0)
             dataSize = 0;
-        std::vector<unsigned char> vchData;
         vchData.resize(dataSize);
         uint256 hashIn;
 
@@ -107,17 +398,15 @@ private:
         }
         filein.fclose();
 
-        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
         // verify stored checksum matches input data
-        uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
+        uint256 hashTmp = Hash(vchData.begin(), vchData.end());
         if (hashIn != hashTmp)
         {
             error("%s: Checksum mismatch, data corrupted", __func__);
             return IncorrectHash;
         }
 
-
+        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
         unsigned char pchMsgTmp[4];
         std::string strMagicMessageTmp;
         try {
@@ -141,7 +430,128 @@ private:
                 error("%s: Invalid network magic number", __func__);
                 return IncorrectMagicNumber;
             }
+        }
+        catch (std::exception &e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return IncorrectFormat;
+        }
+
+        // only the object itself is left
+        vchData.erase(vchData.begin(), vchData.begin() + (vchData.size() - ssObj.size()));
+        return Ok;
+    }
+
+    /**
+     * Write ssObj to the journal.  With fAppend only the chunks that index doesn't know
+     * about are appended after the last intact record, otherwise a fresh journal is
+     * written next to the old file and moved over it.  The index of the result is
+     * cached for the next dump.
+     */
+    bool WriteJournal(const CDataStream& ssObj, const CJournalIndex& index, bool fAppend)
+    {
+        CManifest manifest;
+        manifest.strMagicMessage = strMagicMessage;
+        memcpy(manifest.pchMessageStart, Params().MessageStart(), sizeof(manifest.pchMessageStart));
+        manifest.nDataSize = ssObj.size();
+
+        std::vector<std::pair<size_t, size_t> > vChunkRanges;
+        SplitChunks(ssObj, vChunkRanges);
+
+        boost::filesystem::path pathWrite = fAppend ? pathDB : boost::filesystem::path(pathDB.string() + ".new");
+        FILE *file = fopen(pathWrite.string().c_str(), fAppend ? "r+b" : "wb");
+        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: Failed to open file %s", __func__, pathWrite.string());
+
+        // index of the file as it will be once this write succeeds
+        CJournalIndex indexNew;
+        if (fAppend)
+            indexNew.mapChunks = index.mapChunks;
+        long nPos = fAppend ? index.nValidSize : (long)sizeof(FLATDB_JOURNAL_MAGIC);
+        long nManifestRecordSize = 0;
+
+        size_t nAppended = 0;
+        try {
+            if (fAppend) {
+                // drop whatever a previous, interrupted dump left behind
+                if (index.nValidSize < (long)boost::filesystem::file_size(pathDB))
+                    TruncateFile(fileout.Get(), index.nValidSize);
+                if (fseek(fileout.Get(), index.nValidSize, SEEK_SET))
+                    return error("%s: Failed to seek in %s", __func__, pathWrite.string());
+            } else {
+                fileout.write((const char *)FLATDB_JOURNAL_MAGIC, sizeof(FLATDB_JOURNAL_MAGIC));
+            }
+
+            std::set<uint256> setWritten;
+            for (unsigned int i = 0; i < vChunkRanges.size(); i++) {
+                const char* pchChunk = &ssObj[vChunkRanges[i].first];
+                uint32_t nSize = vChunkRanges[i].second;
+                uint256 hashChunk = Hash(pchChunk, pchChunk + nSize);
+                manifest.vChunks.push_back(hashChunk);
+                if (index.mapChunks.count(hashChunk) || !setWritten.insert(hashChunk).second)
+                    continue;
+                WriteRecord(fileout, RECORD_CHUNK, hashChunk, pchChunk, nSize);
+                indexNew.mapChunks[hashChunk] = std::make_pair(nPos + RECORD_HEADER_SIZE, nSize);
+                nPos += RECORD_HEADER_SIZE + nSize;
+                nAppended += nSize;
+            }
+
+            CDataStream ssManifest(SER_DISK, CLIENT_VERSION);
+            ssManifest << manifest;
+            WriteRecord(fileout, RECORD_MANIFEST, Hash(ssManifest.begin(), ssManifest.end()), &ssManifest[0], ssManifest.size());
+            nManifestRecordSize = RECORD_HEADER_SIZE + ssManifest.size();
+            nPos += nManifestRecordSize;
+            FileCommit(fileout.Get());
+        }
+        catch (std::exception &e) {
+            return error("%s: Serialize or I/O error - %s", __func__, e.what());
+        }
+        fileout.fclose();
+
+        if (!fAppend && !RenameOver(pathWrite, pathDB))
+            return error("%s: Failed to rename %s to %s", __func__, pathWrite.string(), pathDB.string());
+
+        indexNew.manifest = manifest;
+        indexNew.fHaveManifest = true;
+        indexNew.nValidSize = nPos;
+        indexNew.UpdateLiveSize(nManifestRecordSize);
+        CacheIndex(indexNew);
+
+        LogPrintf("Written %u of %u bytes (%u chunks) to %s\n", nAppended, ssObj.size(), vChunkRanges.size(), strFilename);
+        return true;
+    }
+
+    bool Write(const T& objToSave, const CJournalIndex& index, bool fAppend)
+    {
+        // LOCK(objToSave.cs);
+
+        int64_t nStart = GetTimeMillis();
+
+        CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+        ssObj << objToSave;
+
+        if (!WriteJournal(ssObj, index, fAppend))
+            return false;
+
+        LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
+        LogPrintf("     %s\n", objToSave.ToString());
+
+        return true;
+    }
+
+    ReadResult Read(T& objToLoad, bool fDryRun = false)
+    {
+        //LOCK(objToLoad.cs);
+
+        int64_t nStart = GetTimeMillis();
+
+        std::vector<unsigned char> vchData;
+        ReadResult readResult = IsJournal() ? ReadJournal(vchData) : ReadLegacy(vchData);
+        if (readResult != Ok)
+            return readResult;
 
+        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+        try {
             // de-serialize data into T object
             ssObj >> objToLoad;
         }
@@ -198,8 +608,15 @@ public:
         int64_t nStart = GetTimeMillis();
 
         LogPrintf("Verifying %s format...\n", strFilename);
-        T tmpObjToLoad;
-        ReadResult readResult = Read(tmpObjToLoad, true);
+        CJournalIndex index;
+        bool fJournal = IsJournal();
+        ReadResult readResult;
+        if (fJournal) {
+            readResult = ScanJournalFile(index);
+        } else {
+            std::vector<unsigned char> vchData;
+            readResult = ReadLegacy(vchData);
+        }
 
         // there was an error and it was not an error on file opening => do not proceed
         if (readResult == FileError)
@@ -216,13 +633,41 @@ public:
             }
         }
 
-        LogPrintf("Writing info to %s...\n", strFilename);
-        Write(objToSave);
+        // rewrite the journal instead of appending once superseded records dominate it
+        bool fAppend = fJournal && readResult == Ok && !index.NeedsCompaction();
+        LogPrintf("Writing info to %s%s...\n", strFilename, fAppend ? "" : " (full rewrite)");
+        Write(objToSave, index, fAppend);
         LogPrintf("%s dump finished  %dms\n", strFilename, GetTimeMillis() - nStart);
 
         return true;
     }
 
+    /** Rewrite the journal with only the latest dump once superseded records dominate it */
+    bool Compact()
+    {
+        if (!IsJournal())
+            return true; // nothing to compact, converted on the next Dump
+
+        int64_t nStart = GetTimeMillis();
+
+        CJournalIndex index;
+        if (ScanJournalFile(index) != Ok || !index.fHaveManifest)
+            return false;
+        if (!index.NeedsCompaction())
+            return true;
+        long nFileSize = index.nValidSize;
+
+        std::vector<unsigned char> vchData;
+        if (ReadJournal(vchData) != Ok)
+            return false;
+        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+        if (!WriteJournal(ssObj, CJournalIndex(), false))
+            return false;
+
+        LogPrintf("Compacted %s from %d to %d bytes  %dms\n", strFilename, nFileSize, boost::filesystem::file_size(pathDB), GetTimeMillis() - nStart);
+        return true;
+    }
+
 };
 
 
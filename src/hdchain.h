@@ -111,6 +111,8 @@ public:
     uint256 GetID() const { return id; }
 
     uint256 GetSeedHash();
+    //! Derive the key at m/purpose'/coin_type'/account'/change, the parent of all child keys on that chain
+    void DeriveChainExtKey(uint32_t nAccountIndex, bool fInternal, CExtKey& extKeyRet);
     void DeriveChildExtKey(uint32_t nAccountIndex, bool fInternal, uint32_t nChildIndex, CExtKey& extKeyRet);
 
     void AddAccount();
@@ -103,6 +103,19 @@ public:
      */
     void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append data to the reply body without sending it.
+     * The accumulated body is sent, followed by strReply, by WriteReply.
+     *
+     * @note call this before calling WriteReply.
+     */
+    void WriteReplyBody(const char* pch, size_t nSize);
+
+    /**
+     * Discard the body accumulated by WriteReplyBody, e.g. to send an error instead.
+     */
+    void ClearReplyBody();
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
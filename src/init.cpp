@@ -63,6 +63,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <exception>
 #include <memory>
 
 #ifndef WIN32
@@ -127,6 +128,74 @@ enum BindFlags {
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
+/** A masternode cache file being loaded on its own thread during startup */
+struct CCacheLoad
+{
+    std::string strFilename;
+    boost::thread thread;
+    bool fLoaded;
+
+    CCacheLoad() : fLoaded(false) {}
+};
+
+enum MasternodeCacheFile {
+    CACHE_MNCACHE,
+    CACHE_MNPAYMENTS,
+    CACHE_MNSYNCLIST,
+    CACHE_NETFULFILLED,
+    CACHE_COUNT
+};
+
+static CCacheLoad vCacheLoads[CACHE_COUNT];
+
+static CCriticalSection cs_mapCacheLoadTimes;
+static std::map<std::string, int64_t> mapCacheLoadTimes;
+
+template<typename T>
+static void ThreadLoadCache(CCacheLoad* pload, std::string strMagicMessage, T* pobjToLoad)
+{
+    RenameThread("futurocoin-loadcache");
+    int64_t nStart = GetTimeMillis();
+    CFlatDB<T> flatdb(pload->strFilename, strMagicMessage);
+    pload->fLoaded = flatdb.Load(*pobjToLoad);
+    int64_t nLoadTime = GetTimeMillis() - nStart;
+    LogPrintf("Loading %s finished  %dms\n", pload->strFilename, nLoadTime);
+
+    LOCK(cs_mapCacheLoadTimes);
+    mapCacheLoadTimes[pload->strFilename] = nLoadTime;
+}
+
+template<typename T>
+static void StartLoadCache(MasternodeCacheFile file, const std::string& strFilename, const std::string& strMagicMessage, T& objToLoad)
+{
+    CCacheLoad& load = vCacheLoads[file];
+    load.strFilename = strFilename;
+    load.thread = boost::thread(boost::bind(&ThreadLoadCache<T>, &load, strMagicMessage, &objToLoad));
+}
+
+/** The cache files don't depend on each other or on the chain, so they are all read at once */
+static void StartLoadMasternodeCaches()
+{
+    StartLoadCache(CACHE_MNCACHE, "mncache.dat", "magicMasternodeCache", mnodeman);
+    StartLoadCache(CACHE_MNPAYMENTS, "mnpayments.dat", "magicMasternodePaymentsCache", mnpayments);
+    StartLoadCache(CACHE_MNSYNCLIST, "mnsynclist.dat", "magicMasternodeListCache", masternodeListManager);
+    StartLoadCache(CACHE_NETFULFILLED, "netfulfilled.dat", "magicFulfilledCache", netfulfilledman);
+}
+
+static void JoinLoadMasternodeCaches()
+{
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        if (vCacheLoads[i].thread.joinable())
+            vCacheLoads[i].thread.join();
+    }
+}
+
+std::map<std::string, int64_t> GetCacheLoadTimes()
+{
+    LOCK(cs_mapCacheLoadTimes);
+    return mapCacheLoadTimes;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Shutdown
@@ -236,6 +305,8 @@ void PrepareShutdown()
     g_connman.reset();
 
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
+    // (never dump a cache that is still being loaded)
+    JoinLoadMasternodeCaches();
     CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
     flatdb1.Dump(mnodeman);
     CFlatDB<CMasternodePayments> flatdb2("mnpayments.dat", "magicMasternodePaymentsCache");
@@ -325,6 +396,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopDebugLogWriter();
 }
 
 /**
@@ -340,6 +412,23 @@ void HandleSIGHUP(int)
     fReopenDebugLog = true;
 }
 
+/**
+ * Crash paths: get log lines still queued for debug.log out before the
+ * process dies. The signal handler only writes already formatted lines with
+ * write(2); the terminate handler runs in normal context and may use stdio,
+ * but does not wait for the log lock.
+ */
+static void HandleCrashSignal(int)
+{
+    FlushDebugLogFromSignal();
+}
+
+static void HandleTerminate()
+{
+    FlushDebugLog(true);
+    abort();
+}
+
 bool static InitError(const std::string &str)
 {
     uiInterface.ThreadSafeMessageBox(str, "", CClientUIInterface::MSG_ERROR);
@@ -533,7 +622,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
                              "futurocoin (or specifically: instantsend, keepass, masternode, mnpayments, mnsync, spork)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
@@ -698,6 +787,15 @@ void CleanupBlockRevFiles()
     }
 }
 
+/** Drop superseded dumps from the masternode cache journals, off the shutdown path */
+static void CompactMasternodeCaches()
+{
+    CFlatDB<CMasternodeMan>("mncache.dat", "magicMasternodeCache").Compact();
+    CFlatDB<CMasternodePayments>("mnpayments.dat", "magicMasternodePaymentsCache").Compact();
+    CFlatDB<CMasternodeListManager>("mnsynclist.dat", "magicMasternodeListCache").Compact();
+    CFlatDB<CNetFulfilledRequestManager>("netfulfilled.dat", "magicFulfilledCache").Compact();
+}
+
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     const CChainParams& chainparams = Params();
@@ -958,9 +1056,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     sa_hup.sa_flags = 0;
     sigaction(SIGHUP, &sa_hup, NULL);
 
+    // Flush queued debug.log lines when crashing; the default action follows
+    struct sigaction sa_crash;
+    sa_crash.sa_handler = HandleCrashSignal;
+    sigemptyset(&sa_crash.sa_mask);
+    sa_crash.sa_flags = SA_RESETHAND;
+    sigaction(SIGABRT, &sa_crash, NULL);
+    sigaction(SIGSEGV, &sa_crash, NULL);
+
     // Ignore SIGPIPE, otherwise it will bring the daemon down if the client closes unexpectedly
     signal(SIGPIPE, SIG_IGN);
 #endif
+    std::set_terminate(HandleTerminate);
 
     // ********************************************************* Step 2: parameter interactions
     const CChainParams& chainparams = Params();
@@ -1401,6 +1508,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 7: load block chain
 
+    // Read the masternode caches in the background while the block index loads,
+    // they are collected in step 11b
+    StartLoadMasternodeCaches();
+
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
@@ -1722,9 +1833,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+            CBlockIndex* pindexScanned = NULL;
+            pwalletMain->ScanForWalletTransactions(pindexRescan, true, NULL, &pindexScanned);
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(chainActive.GetLocator());
+            // after an interrupted rescan only record the blocks that were actually scanned
+            if (pindexScanned)
+                pwalletMain->SetBestChain(chainActive.GetLocator(pindexScanned));
             nWalletDBUpdated++;
 
             // Restore wallet transaction metadata after -zapwallettxes=1
@@ -1832,40 +1946,35 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // LOAD SERIALIZED DAT FILES INTO DATA CACHES FOR INTERNAL USE
 
     boost::filesystem::path pathDB = GetDataDir();
-    std::string strDBName;
 
-    strDBName = "mncache.dat";
     uiInterface.InitMessage(_("Loading masternode cache..."));
-    CFlatDB<CMasternodeMan> flatdb1(strDBName, "magicMasternodeCache");
-    if(!flatdb1.Load(mnodeman)) {
-        return InitError(_("Failed to load masternode cache from") + "\n" + (pathDB / strDBName).string());
+    JoinLoadMasternodeCaches();
+
+    if(!vCacheLoads[CACHE_MNCACHE].fLoaded) {
+        return InitError(_("Failed to load masternode cache from") + "\n" + (pathDB / "mncache.dat").string());
     }
 
     if(mnodeman.size()) {
-        strDBName = "mnpayments.dat";
-        uiInterface.InitMessage(_("Loading masternode payment cache..."));
-        CFlatDB<CMasternodePayments> flatdb2(strDBName, "magicMasternodePaymentsCache");
-        if(!flatdb2.Load(mnpayments)) {
-            return InitError(_("Failed to load masternode payments cache from") + "\n" + (pathDB / strDBName).string());
+        if(!vCacheLoads[CACHE_MNPAYMENTS].fLoaded) {
+            return InitError(_("Failed to load masternode payments cache from") + "\n" + (pathDB / "mnpayments.dat").string());
         }
     } else {
+        // payments are meaningless without the masternodes they refer to
         uiInterface.InitMessage(_("Masternode cache is empty, skipping payments..."));
+        mnpayments.Clear();
     }
 
-    strDBName = "mnsynclist.dat";
-    uiInterface.InitMessage(_("Loading masternode sync list cache..."));
-    CFlatDB<CMasternodeListManager> flatdb3(strDBName, "magicMasternodeListCache");
-    if (!flatdb3.Load(masternodeListManager)) {
-        return InitError(_("Failed to load masternode sync list cache from") + "\n" + (pathDB / strDBName).string());
+    if (!vCacheLoads[CACHE_MNSYNCLIST].fLoaded) {
+        return InitError(_("Failed to load masternode sync list cache from") + "\n" + (pathDB / "mnsynclist.dat").string());
     }
 
-    strDBName = "netfulfilled.dat";
-    uiInterface.InitMessage(_("Loading fulfilled requests cache..."));
-    CFlatDB<CNetFulfilledRequestManager> flatdb4(strDBName, "magicFulfilledCache");
-    if(!flatdb4.Load(netfulfilledman)) {
-        return InitError(_("Failed to load fulfilled requests cache from") + "\n" + (pathDB / strDBName).string());
+    if(!vCacheLoads[CACHE_NETFULFILLED].fLoaded) {
+        return InitError(_("Failed to load fulfilled requests cache from") + "\n" + (pathDB / "netfulfilled.dat").string());
     }
 
+    // dumps only append to the cache files, compact them once the node is up
+    scheduler.scheduleFromNow(&CompactMasternodeCaches, 60);
+
     // ********************************************************* Step 11c: update block tip in FuturoCoin modules
 
     // force UpdatedBlockTip to initialize nCachedBlockHeight for DS, MN payments and budgets
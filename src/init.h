@@ -6,6 +6,8 @@
 #ifndef BITCOIN_INIT_H
 #define BITCOIN_INIT_H
 
+#include <map>
+#include <stdint.h>
 #include <string>
 
 class CScheduler;
@@ -29,6 +31,8 @@ void InitLogging();
 void InitParameterInteraction();
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler);
 void PrepareShutdown();
+/** Milliseconds each masternode cache file took to load at startup, by file name */
+std::map<std::string, int64_t> GetCacheLoadTimes();
 
 /** The help message mode determines what help message to show */
 enum HelpMessageMode {
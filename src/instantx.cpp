@@ -1160,7 +1160,7 @@ bool CTxLockVote::Sign()
 void CTxLockVote::Relay(CConnman& connman) const
 {
     CInv inv(MSG_TXLOCK_VOTE, GetHash());
-    connman.RelayInv(inv);
+    connman.RelayInv(inv, connman.MakeSharedMessage(PROTOCOL_VERSION, NetMsgType::TXLOCKVOTE, *this));
 }
 
 bool CTxLockVote::IsExpired(int nHeight) const
@@ -103,6 +103,74 @@ void CMasternodePayments::Clear()
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
     mapMasternodeBlocks.clear();
     mapMasternodePaymentVotes.clear();
+    mapVoteHashesByHeight.clear();
+    mapBestPayees.clear();
+    mapBestPayeeHeights.clear();
+}
+
+void CMasternodePayments::UpdateBestPayee(int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    EraseBestPayee(nBlockHeight);
+
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    CScript payee;
+    if(it == mapMasternodeBlocks.end() || !it->second.GetBestPayee(payee)) return;
+
+    mapBestPayees[nBlockHeight] = payee;
+    mapBestPayeeHeights[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::EraseBestPayee(int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    std::map<int, CScript>::iterator it = mapBestPayees.find(nBlockHeight);
+    if(it == mapBestPayees.end()) return;
+
+    std::map<CScript, std::set<int> >::iterator itHeights = mapBestPayeeHeights.find(it->second);
+    if(itHeights != mapBestPayeeHeights.end()) {
+        itHeights->second.erase(nBlockHeight);
+        if(itHeights->second.empty())
+            mapBestPayeeHeights.erase(itHeights);
+    }
+    mapBestPayees.erase(it);
+}
+
+void CMasternodePayments::RebuildBestPayees()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapBestPayees.clear();
+    mapBestPayeeHeights.clear();
+    for (const auto& blockpair : mapMasternodeBlocks) {
+        UpdateBestPayee(blockpair.first);
+    }
+}
+
+void CMasternodePayments::StoreVote(const uint256& nHash, const CMasternodePaymentVote& vote)
+{
+    AssertLockHeld(cs_mapMasternodePaymentVotes);
+
+    std::pair<std::map<uint256, CMasternodePaymentVote>::iterator, bool> ret =
+            mapMasternodePaymentVotes.insert(std::make_pair(nHash, vote));
+    if(!ret.second) {
+        // already bucketed, just update the stored copy (e.g. it's verified now)
+        ret.first->second = vote;
+        return;
+    }
+    mapVoteHashesByHeight[vote.nBlockHeight].push_back(nHash);
+}
+
+void CMasternodePayments::RebuildVoteHeights()
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+
+    mapVoteHashesByHeight.clear();
+    for (const auto& votepair : mapMasternodePaymentVotes) {
+        mapVoteHashesByHeight[votepair.second.nBlockHeight].push_back(votepair.first);
+    }
 }
 
 // SPORK_14_MNODES_RELEASE_ENABLED active
@@ -236,10 +304,11 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand,
             }
 
             // Avoid processing same vote multiple times
-            mapMasternodePaymentVotes[nHash] = vote;
             // but first mark vote as non-verified,
             // AddPaymentVote() below should take care of it if vote is actually ok
-            mapMasternodePaymentVotes[nHash].MarkAsNotVerified();
+            CMasternodePaymentVote voteSeen(vote);
+            voteSeen.MarkAsNotVerified();
+            StoreVote(nHash, voteSeen);
         }
 
         int nFirstBlock = nCachedBlockHeight - GetStorageLimit();
@@ -326,6 +395,7 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand,
         if(AddPaymentVote(vote)){
             vote.Relay(connman);
             masternodeSync.BumpAssetLastTime("MASTERNODEPAYMENTVOTE");
+            masternodeSync.AddItemReceived(MASTERNODE_SYNC_MNW);
         }
     }
 }
@@ -376,14 +446,13 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
         mnpayee = GetScriptForDestination(mn.payee.Get());
     }
 
-    CScript payee;
-    for (int64_t h = nCachedBlockHeight; h <= nCachedBlockHeight + 8; h++){
-        if (h == nNotBlockHeight) continue;
-        if (mapMasternodeBlocks.count(h) &&
-            mapMasternodeBlocks[h].GetBestPayee(payee) &&
-            mnpayee == payee) {
-            return true;
-        }
+    std::map<CScript, std::set<int> >::const_iterator it = mapBestPayeeHeights.find(mnpayee);
+    if (it == mapBestPayeeHeights.end()) return false;
+
+    const std::set<int>& setHeights = it->second;
+    for (std::set<int>::const_iterator itHeight = setHeights.lower_bound(nCachedBlockHeight);
+            itHeight != setHeights.end() && *itHeight <= nCachedBlockHeight + 8; ++itHeight) {
+        if (*itHeight != nNotBlockHeight) return true;
     }
 
     return false;
@@ -398,7 +467,7 @@ bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
 
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
 
-    mapMasternodePaymentVotes[vote.GetHash()] = vote;
+    StoreVote(vote.GetHash(), vote);
 
     if(!mapMasternodeBlocks.count(vote.nBlockHeight)) {
        CMasternodeBlockPayees blockPayees(vote.nBlockHeight);
@@ -406,6 +475,7 @@ bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
     }
 
     mapMasternodeBlocks[vote.nBlockHeight].AddPayee(vote);
+    UpdateBestPayee(vote.nBlockHeight);
 
     return true;
 }
@@ -417,6 +487,15 @@ bool CMasternodePayments::HasVerifiedPaymentVote(uint256 hashIn)
     return it != mapMasternodePaymentVotes.end() && it->second.IsVerified();
 }
 
+bool CMasternodePayments::GetVerifiedPaymentVote(const uint256& hashIn, CMasternodePaymentVote& voteRet)
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+    std::map<uint256, CMasternodePaymentVote>::const_iterator it = mapMasternodePaymentVotes.find(hashIn);
+    if(it == mapMasternodePaymentVotes.end() || !it->second.IsVerified()) return false;
+    voteRet = it->second;
+    return true;
+}
+
 void CMasternodeBlockPayees::AddPayee(const CMasternodePaymentVote& vote)
 {
     LOCK(cs_vecPayees);
@@ -554,27 +633,129 @@ bool CMasternodePayments::IsTransactionValid(const CTransaction& txNew, int nBlo
     return true;
 }
 
+void CCoinbasePayeeIndex::AddBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    EraseHeight(pindex->nHeight);
+
+    CBlockPayees& entry = mapBlocks[pindex->nHeight];
+    entry.hashBlock = pindex->GetBlockHash();
+    entry.nTime = pindex->nTime;
+
+    if(block.vtx.empty()) return;
+
+    CAmount nMasternodePayment = GetMasternodePayment(pindex->nHeight, block.vtx[0].GetValueOut());
+    BOOST_FOREACH(const CTxOut& txout, block.vtx[0].vout) {
+        if(txout.nValue != nMasternodePayment) continue;
+        entry.vecPayees.push_back(txout.scriptPubKey);
+        mapPayeeHeights[txout.scriptPubKey].insert(pindex->nHeight);
+    }
+}
+
+void CCoinbasePayeeIndex::EraseHeight(int nHeight)
+{
+    std::map<int, CBlockPayees>::iterator it = mapBlocks.find(nHeight);
+    if(it == mapBlocks.end()) return;
+
+    BOOST_FOREACH(const CScript& payee, it->second.vecPayees) {
+        std::map<CScript, std::set<int> >::iterator itPayee = mapPayeeHeights.find(payee);
+        if(itPayee == mapPayeeHeights.end()) continue;
+        itPayee->second.erase(nHeight);
+        if(itPayee->second.empty())
+            mapPayeeHeights.erase(itPayee);
+    }
+    mapBlocks.erase(it);
+}
+
+void CCoinbasePayeeIndex::ConnectBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    AddBlock(block, pindex);
+}
+
+void CCoinbasePayeeIndex::DisconnectBlock(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    EraseHeight(pindex->nHeight);
+}
+
+void CCoinbasePayeeIndex::Fill(const CBlockIndex* pindex, int nDepth, const std::map<int, CMasternodeBlockPayees>& mapBlockPayees)
+{
+    LOCK(cs);
+
+    const CBlockIndex* pindexWalk = pindex;
+    for (int i = 0; pindexWalk && i < nDepth; i++, pindexWalk = pindexWalk->pprev) {
+        // no one can have been paid here with enough votes, don't bother reading it
+        if(!mapBlockPayees.count(pindexWalk->nHeight)) continue;
+
+        std::map<int, CBlockPayees>::const_iterator it = mapBlocks.find(pindexWalk->nHeight);
+        if(it != mapBlocks.end() && it->second.hashBlock == pindexWalk->GetBlockHash()) continue;
+
+        CBlock block;
+        if(!ReadBlockFromDisk(block, pindexWalk, Params().GetConsensus())) // shouldn't really happen
+            continue;
+        AddBlock(block, pindexWalk);
+    }
+}
+
+bool CCoinbasePayeeIndex::GetLastPaid(const CScript& payee, const CBlockIndex* pindex, int nMinHeight, int nVotesReq,
+                                      std::map<int, CMasternodeBlockPayees>& mapBlockPayees, int& nHeightRet, int64_t& nTimeRet) const
+{
+    LOCK(cs);
+
+    std::map<CScript, std::set<int> >::const_iterator itPayee = mapPayeeHeights.find(payee);
+    if(itPayee == mapPayeeHeights.end()) return false;
+
+    const std::set<int>& setHeights = itPayee->second;
+    for (std::set<int>::const_reverse_iterator it = std::set<int>::const_reverse_iterator(setHeights.upper_bound(pindex->nHeight));
+            it != setHeights.rend() && *it > nMinHeight; ++it) {
+        const CBlockPayees& entry = mapBlocks.find(*it)->second;
+        // the entry might belong to a block on another branch
+        const CBlockIndex* pindexAncestor = pindex->GetAncestor(*it);
+        if(!pindexAncestor || pindexAncestor->GetBlockHash() != entry.hashBlock) continue;
+
+        std::map<int, CMasternodeBlockPayees>::iterator itVotes = mapBlockPayees.find(*it);
+        if(itVotes == mapBlockPayees.end() || !itVotes->second.HasPayeeWithVotes(payee, nVotesReq)) continue;
+
+        nHeightRet = *it;
+        nTimeRet = entry.nTime;
+        return true;
+    }
+    return false;
+}
+
+void CCoinbasePayeeIndex::Trim(int nMinHeight)
+{
+    LOCK(cs);
+    while(!mapBlocks.empty() && mapBlocks.begin()->first < nMinHeight)
+        EraseHeight(mapBlocks.begin()->first);
+}
+
 void CMasternodePayments::CheckAndRemove()
 {
     if(!masternodeSync.IsBlockchainSynced()) return;
 
-    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
-
-    int nLimit = GetStorageLimit();
+    RemoveBelowHeight(nCachedBlockHeight - GetStorageLimit());
+    LogPrintf("CMasternodePayments::CheckAndRemove -- %s\n", ToString());
+}
 
-    std::map<uint256, CMasternodePaymentVote>::iterator it = mapMasternodePaymentVotes.begin();
-    while(it != mapMasternodePaymentVotes.end()) {
-        CMasternodePaymentVote vote = (*it).second;
+void CMasternodePayments::RemoveBelowHeight(int nMinHeight)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
 
-        if(nCachedBlockHeight - vote.nBlockHeight > nLimit) {
-            LogPrint("mnpayments", "CMasternodePayments::CheckAndRemove -- Removing old Masternode payment: nBlockHeight=%d\n", vote.nBlockHeight);
-            mapMasternodePaymentVotes.erase(it++);
-            mapMasternodeBlocks.erase(vote.nBlockHeight);
-        } else {
-            ++it;
+    // Buckets are ordered by height, so everything out of the window is at the front
+    std::map<int, std::vector<uint256> >::iterator it = mapVoteHashesByHeight.begin();
+    while(it != mapVoteHashesByHeight.end() && it->first < nMinHeight) {
+        LogPrint("mnpayments", "CMasternodePayments::CheckAndRemove -- Removing old Masternode payments: nBlockHeight=%d, votes=%d\n", it->first, (int)it->second.size());
+        BOOST_FOREACH(const uint256& hash, it->second) {
+            mapMasternodePaymentVotes.erase(hash);
         }
+        mapVoteHashesByHeight.erase(it++);
     }
-    LogPrintf("CMasternodePayments::CheckAndRemove -- %s\n", ToString());
+    while(!mapMasternodeBlocks.empty() && mapMasternodeBlocks.begin()->first < nMinHeight) {
+        EraseBestPayee(mapMasternodeBlocks.begin()->first);
+        mapMasternodeBlocks.erase(mapMasternodeBlocks.begin());
+    }
+    payeeIndex.Trim(nMinHeight);
 }
 
 bool CMasternodePaymentVote::IsValid(CNode* pnode, int nValidationHeight, std::string& strError, CConnman& connman)
@@ -754,34 +935,38 @@ void CMasternodePayments::CheckPreviousBlockVotes(int nPrevBlockHeight)
 {
     if (!masternodeSync.IsWinnersListSynced()) return;
 
+    // The report below is only useful with -debug=mnpayments, so don't build it otherwise
+    const bool fLog = LogAcceptCategory("mnpayments");
     std::string debugStr;
 
-    debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes -- nPrevBlockHeight=%d, expected voting MNs:\n",
-                          nPrevBlockHeight);
+    if (fLog) debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes -- nPrevBlockHeight=%d, expected voting MNs:\n",
+                                    nPrevBlockHeight);
 
     CMasternodeMan::rank_pair_vec_t mns;
     if (!mnodeman.GetMasternodeRanks(mns, nPrevBlockHeight - 101, GetMinMasternodePaymentsProto())) {
-        debugStr += "CMasternodePayments::CheckPreviousBlockVotes -- GetMasternodeRanks failed\n";
-        LogPrint("mnpayments", "%s", debugStr);
+        if (fLog) LogPrintStr(debugStr + "CMasternodePayments::CheckPreviousBlockVotes -- GetMasternodeRanks failed\n");
         return;
     }
 
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
 
+    std::map<int, CMasternodeBlockPayees>::const_iterator itBlock = mapMasternodeBlocks.find(nPrevBlockHeight);
+
     for (int i = 0; i < MNPAYMENTS_SIGNATURES_TOTAL && i < (int)mns.size(); i++) {
-        auto mn = mns[i];
+        const auto& mn = mns[i];
         CScript payee;
         bool found = false;
 
-        if (mapMasternodeBlocks.count(nPrevBlockHeight)) {
-            for (auto &p : mapMasternodeBlocks[nPrevBlockHeight].vecPayees) {
-                for (auto &voteHash : p.GetVoteHashes()) {
-                    if (!mapMasternodePaymentVotes.count(voteHash)) {
-                        debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   could not find vote %s\n",
-                                              voteHash.ToString());
+        if (itBlock != mapMasternodeBlocks.end()) {
+            for (const auto &p : itBlock->second.vecPayees) {
+                for (const auto &voteHash : p.GetVoteHashes()) {
+                    auto itVote = mapMasternodePaymentVotes.find(voteHash);
+                    if (itVote == mapMasternodePaymentVotes.end()) {
+                        if (fLog) debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   could not find vote %s\n",
+                                                        voteHash.ToString());
                         continue;
                     }
-                    auto vote = mapMasternodePaymentVotes[voteHash];
+                    const CMasternodePaymentVote& vote = itVote->second;
                     if (vote.pubKeyMasternode == mn.second.pubKeyMasternode) {
                         payee = vote.payee;
                         found = true;
@@ -792,12 +977,14 @@ void CMasternodePayments::CheckPreviousBlockVotes(int nPrevBlockHeight)
         }
 
         if (!found) {
-            debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   %s - no vote received\n",
-                                  HexStr(mn.second.pubKeyMasternode));
+            if (fLog) debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   %s - no vote received\n",
+                                            HexStr(mn.second.pubKeyMasternode));
             mapMasternodesDidNotVote[mn.second.pubKeyMasternode]++;
             continue;
         }
 
+        if (!fLog) continue;
+
         CTxDestination address1;
         ExtractDestination(payee, address1);
         CBitcoinAddress address2(address1);
@@ -805,14 +992,16 @@ void CMasternodePayments::CheckPreviousBlockVotes(int nPrevBlockHeight)
         debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   %s - voted for %s\n",
                               HexStr(mn.second.pubKeyMasternode), address2.ToString());
     }
+    if (!fLog) return;
+
     debugStr += "CMasternodePayments::CheckPreviousBlockVotes -- Masternodes which missed a vote in the past:\n";
 
-    for (auto it : mapMasternodesDidNotVote) {
+    for (const auto& it : mapMasternodesDidNotVote) {
         debugStr += strprintf("CMasternodePayments::CheckPreviousBlockVotes --   %s: %d\n",
                               HexStr(it.first), it.second);
     }
 
-    LogPrint("mnpayments", "%s", debugStr);
+    LogPrintStr(debugStr);
 }
 
 void CMasternodePaymentVote::Relay(CConnman& connman)
@@ -867,29 +1056,34 @@ std::string CMasternodePaymentVote::ToString() const
 // Send only votes for future blocks, node should request every other missing payment block individually
 void CMasternodePayments::Sync(CNode* pnode, CConnman& connman)
 {
-    LOCK(cs_mapMasternodeBlocks);
-
     if(!masternodeSync.IsWinnersListSynced()) return;
 
-    int nInvCount = 0;
-
-    for(int h = nCachedBlockHeight; h < nCachedBlockHeight + 20; h++) {
-        if(mapMasternodeBlocks.count(h)) {
-            BOOST_FOREACH(CMasternodePayee& payee, mapMasternodeBlocks[h].vecPayees) {
-                std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
-                BOOST_FOREACH(uint256& hash, vecVoteHashes) {
-                    if(!HasVerifiedPaymentVote(hash)) continue;
-                    pnode->PushInventory(CInv(MSG_MASTERNODE_PAYMENT_VOTE, hash));
-                    nInvCount++;
-                }
-            }
-        }
+    std::vector<uint256> vecHashes;
+    GetVoteHashesToSync(nCachedBlockHeight, vecHashes);
+    BOOST_FOREACH(const uint256& hash, vecHashes) {
+        pnode->PushInventory(CInv(MSG_MASTERNODE_PAYMENT_VOTE, hash));
     }
+    int nInvCount = vecHashes.size();
 
     LogPrintf("CMasternodePayments::Sync -- Sent %d votes to peer %d\n", nInvCount, pnode->id);
     connman.PushMessage(pnode, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_MNW, nInvCount);
 }
 
+void CMasternodePayments::GetVoteHashesToSync(int nHeight, std::vector<uint256>& vecHashesRet)
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+
+    vecHashesRet.clear();
+    std::map<int, std::vector<uint256> >::const_iterator it = mapVoteHashesByHeight.lower_bound(nHeight);
+    for(; it != mapVoteHashesByHeight.end() && it->first < nHeight + 20; ++it) {
+        BOOST_FOREACH(const uint256& hash, it->second) {
+            std::map<uint256, CMasternodePaymentVote>::const_iterator itVote = mapMasternodePaymentVotes.find(hash);
+            if(itVote == mapMasternodePaymentVotes.end() || !itVote->second.IsVerified()) continue;
+            vecHashesRet.push_back(hash);
+        }
+    }
+}
+
 // Request low data/unknown payment blocks in batches directly from some node instead of/after preliminary Sync.
 void CMasternodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& connman)
 {
@@ -68,7 +68,7 @@ public:
     CScript GetPayee() { return scriptPubKey; }
 
     void AddVoteHash(uint256 hashIn) { vecVoteHashes.push_back(hashIn); }
-    std::vector<uint256> GetVoteHashes() { return vecVoteHashes; }
+    const std::vector<uint256>& GetVoteHashes() const { return vecVoteHashes; }
     int GetVoteCount() { return vecVoteHashes.size(); }
 };
 
@@ -176,12 +176,46 @@ public:
     bool IsValid(CNode* pnode, int nValidationHeight, std::string& strError, CConnman& connman);
     void Relay(CConnman& connman);
 
-    bool IsVerified() { return !vchSig.empty(); }
+    bool IsVerified() const { return !vchSig.empty(); }
     void MarkAsNotVerified() { vchSig.clear(); }
 
     std::string ToString() const;
 };
 
+//
+// Coinbase Payee Index
+// Keeps track of who actually got paid in recent blocks
+//
+
+class CCoinbasePayeeIndex
+{
+private:
+    struct CBlockPayees {
+        uint256 hashBlock;
+        int64_t nTime;
+        // scripts paid exactly the masternode payment in the coinbase
+        std::vector<CScript> vecPayees;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<int, CBlockPayees> mapBlocks;
+    std::map<CScript, std::set<int> > mapPayeeHeights;
+
+    void AddBlock(const CBlock& block, const CBlockIndex* pindex);
+    void EraseHeight(int nHeight);
+
+public:
+    void ConnectBlock(const CBlock& block, const CBlockIndex* pindex);
+    void DisconnectBlock(const CBlockIndex* pindex);
+
+    /// Read the blocks among the last nDepth up to pindex that have payment votes but aren't indexed yet
+    void Fill(const CBlockIndex* pindex, int nDepth, const std::map<int, CMasternodeBlockPayees>& mapBlockPayees);
+    /// Find the most recent block in (nMinHeight, pindex] whose coinbase paid payee with at least nVotesReq votes behind it
+    bool GetLastPaid(const CScript& payee, const CBlockIndex* pindex, int nMinHeight, int nVotesReq,
+                     std::map<int, CMasternodeBlockPayees>& mapBlockPayees, int& nHeightRet, int64_t& nTimeRet) const;
+    void Trim(int nMinHeight);
+};
+
 //
 // Masternode Payments Class
 // Keeps track of who should get paid for which blocks
@@ -198,12 +232,31 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
+    // Current winner of every block in mapMasternodeBlocks and the heights each
+    // payee is winning, so IsScheduled doesn't have to recount the votes
+    std::map<int, CScript> mapBestPayees;
+    std::map<CScript, std::set<int> > mapBestPayeeHeights;
+
+    // Hashes of all votes in mapMasternodePaymentVotes (verified or not) bucketed
+    // by the height they vote for, so old heights expire from the front and the
+    // votes for a given height can be walked without scanning the whole map
+    std::map<int, std::vector<uint256> > mapVoteHashesByHeight;
+
+    void UpdateBestPayee(int nBlockHeight);
+    void EraseBestPayee(int nBlockHeight);
+    void RebuildBestPayees();
+
+    void StoreVote(const uint256& nHash, const CMasternodePaymentVote& vote);
+    void RebuildVoteHeights();
+
 public:
     std::map<uint256, CMasternodePaymentVote> mapMasternodePaymentVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
     std::map<COutPoint, int> mapMasternodesLastVoteMnRel;
     std::map<CPubKey, int> mapMasternodesLastVote;
     std::map<CPubKey, int> mapMasternodesDidNotVote;
+    // not serialized, rebuilt from the chain
+    CCoinbasePayeeIndex payeeIndex;
 
     CMasternodePayments() : nStorageCoeff(1.25), nMinBlocksToStore(5000) {}
 
@@ -213,18 +266,27 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(mapMasternodePaymentVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead()) {
+            RebuildVoteHeights();
+            RebuildBestPayees();
+        }
     }
 
     void Clear();
 
     bool AddPaymentVote(const CMasternodePaymentVote& vote);
     bool HasVerifiedPaymentVote(uint256 hashIn);
+    bool GetVerifiedPaymentVote(const uint256& hashIn, CMasternodePaymentVote& voteRet);
     bool ProcessBlock(int nBlockHeight, CConnman& connman);
     void CheckPreviousBlockVotes(int nPrevBlockHeight);
 
     void Sync(CNode* node, CConnman& connman);
     void RequestLowDataPaymentBlocks(CNode* pnode, CConnman& connman);
     void CheckAndRemove();
+    // drop the votes and blocks below nMinHeight, CheckAndRemove's storage window
+    void RemoveBelowHeight(int nMinHeight);
+    // verified votes for the 20 blocks starting at nHeight, what Sync announces
+    void GetVoteHashesToSync(int nHeight, std::vector<uint256>& vecHashesRet);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
@@ -40,9 +40,56 @@ void CMasternodeSync::BumpAssetLastTime(std::string strFuncName)
     LogPrint("mnsync", "CMasternodeSync::BumpAssetLastTime -- %s\n", strFuncName);
 }
 
+void CMasternodeSync::AddItemReceived(int nAsset)
+{
+    // only items of the asset we are syncing right now, anything else is just relayed to us
+    if(nAsset != nRequestedMasternodeAssets) return;
+    LOCK(cs_stats);
+    mapAssetStats[nAsset].nItemsReceived++;
+}
+
+int CMasternodeSync::GetPeersDone(int nAsset)
+{
+    LOCK(cs_stats);
+    std::map<int, CAssetStats>::const_iterator it = mapAssetStats.find(nAsset);
+    return it == mapAssetStats.end() ? 0 : it->second.nPeersDone;
+}
+
+void CMasternodeSync::AddPeerAsked(NodeId nodeid)
+{
+    LOCK(cs_stats);
+    mapAssetStats[nRequestedMasternodeAssets].setPeersAsked.insert(nodeid);
+}
+
+UniValue CMasternodeSync::GetAssetStats()
+{
+    LOCK(cs_stats);
+    UniValue obj(UniValue::VOBJ);
+    BOOST_FOREACH(const PAIRTYPE(int, CAssetStats)& pair, mapAssetStats) {
+        const CAssetStats& stats = pair.second;
+        int64_t nSeconds = (stats.nTimeFinished ? stats.nTimeFinished : GetTime()) - stats.nTimeStarted;
+        UniValue objAsset(UniValue::VOBJ);
+        objAsset.push_back(Pair("StartTime", stats.nTimeStarted));
+        objAsset.push_back(Pair("Seconds", nSeconds));
+        objAsset.push_back(Pair("IsFinished", stats.nTimeFinished != 0));
+        objAsset.push_back(Pair("PeersAsked", (int)stats.setPeersAsked.size()));
+        objAsset.push_back(Pair("PeersDone", stats.nPeersDone));
+        objAsset.push_back(Pair("ItemsAnnounced", stats.nItemsAnnounced));
+        objAsset.push_back(Pair("ItemsReceived", stats.nItemsReceived));
+        objAsset.push_back(Pair("ItemsPerSecond", nSeconds > 0 ? double(stats.nItemsReceived) / nSeconds : double(stats.nItemsReceived)));
+        obj.push_back(Pair(GetAssetName(pair.first), objAsset));
+    }
+    return obj;
+}
+
 std::string CMasternodeSync::GetAssetName()
 {
-    switch(nRequestedMasternodeAssets)
+    return GetAssetName(nRequestedMasternodeAssets);
+}
+
+std::string CMasternodeSync::GetAssetName(int nAsset)
+{
+    switch(nAsset)
     {
         case(MASTERNODE_SYNC_INITIAL):      return "MASTERNODE_SYNC_INITIAL";
         case(MASTERNODE_SYNC_WAITING):      return "MASTERNODE_SYNC_WAITING";
@@ -56,6 +103,8 @@ std::string CMasternodeSync::GetAssetName()
 
 void CMasternodeSync::SwitchToNextAsset(CConnman& connman)
 {
+    int nRequestedMasternodeAssetsPrev = nRequestedMasternodeAssets;
+
     switch(nRequestedMasternodeAssets)
     {
         case(MASTERNODE_SYNC_FAILED):
@@ -96,6 +145,20 @@ void CMasternodeSync::SwitchToNextAsset(CConnman& connman)
             break;
     }
     nRequestedMasternodeAttempt = 0;
+    {
+        LOCK(cs_stats);
+        if (nRequestedMasternodeAssetsPrev == MASTERNODE_SYNC_INITIAL) {
+            // blockchain is synced, (re)start collecting stats for the assets below
+            mapAssetStats.clear();
+        }
+        std::map<int, CAssetStats>::iterator it = mapAssetStats.find(nRequestedMasternodeAssetsPrev);
+        if (it != mapAssetStats.end()) {
+            it->second.nTimeFinished = GetTime();
+        }
+        if (nRequestedMasternodeAssets != MASTERNODE_SYNC_FINISHED) {
+            mapAssetStats[nRequestedMasternodeAssets].nTimeStarted = GetTime();
+        }
+    }
     nTimeAssetSyncStarted = GetTime();
     BumpAssetLastTime("CMasternodeSync::SwitchToNextAsset");
 }
@@ -125,6 +188,20 @@ void CMasternodeSync::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
         vRecv >> nItemID >> nCount;
 
         LogPrintf("SYNCSTATUSCOUNT -- got inventory count: nItemID=%d  nCount=%d  peer=%d\n", nItemID, nCount, pfrom->id);
+
+        if(nItemID != nRequestedMasternodeAssets) return;
+
+        LOCK(cs_stats);
+        CAssetStats& stats = mapAssetStats[nItemID];
+        // only count answers to our own requests, and each peer once per asset
+        if(!stats.setPeersAsked.count(pfrom->id) || !stats.setPeersReported.insert(pfrom->id).second) return;
+        stats.nItemsAnnounced += nCount;
+        // Newer peers send the masternode list itself before the count, older ones
+        // only sent the invs and we still have to wait for the data to arrive.
+        // A peer with nothing to send doesn't help us finish, keep asking others then.
+        if(nCount > 0 && (nItemID != MASTERNODE_SYNC_LIST || pfrom->nVersion >= MNB_BATCH_VERSION)) {
+            stats.nPeersDone++;
+        }
     }
 }
 
@@ -180,6 +257,8 @@ void CMasternodeSync::ProcessTick(CConnman& connman)
     uiInterface.NotifyAdditionalDataSyncProgressChanged(nSyncProgress);
 
     std::vector<CNode*> vNodesCopy = connman.CopyNodeVector();
+    // number of peers we requested the current asset from during this tick
+    int nRequestsThisTick = 0;
 
     BOOST_FOREACH(CNode* pnode, vNodesCopy)
     {
@@ -269,6 +348,16 @@ void CMasternodeSync::ProcessTick(CConnman& connman)
                     return;
                 }
 
+                // check for data
+                // peers which already sent us the whole list don't leave anything to wait for,
+                // move on as soon as we have it from at least two of them
+                if(GetPeersDone(MASTERNODE_SYNC_LIST) > 1) {
+                    LogPrintf("CMasternodeSync::ProcessTick -- nTick %d nRequestedMasternodeAssets %d -- found enough data\n", nTick, nRequestedMasternodeAssets);
+                    SwitchToNextAsset(connman);
+                    connman.ReleaseNodeVector(vNodesCopy);
+                    return;
+                }
+
                 // only request once from each peer
                 if(netfulfilledman.HasFulfilledRequest(pnode->addr, "masternode-list-sync")) continue;
                 netfulfilledman.AddFulfilledRequest(pnode->addr, "masternode-list-sync");
@@ -276,7 +365,12 @@ void CMasternodeSync::ProcessTick(CConnman& connman)
                 if (pnode->nVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
                 nRequestedMasternodeAttempt++;
 
-                mnodeman.DsegUpdate(pnode, connman);
+                // we asked this peer recently already, don't count it as a request of this tick
+                if(!mnodeman.DsegUpdate(pnode, connman)) continue;
+                AddPeerAsked(pnode->id);
+
+                // ask a few more peers in parallel before waiting for the next tick
+                if(++nRequestsThisTick < MASTERNODE_SYNC_PARALLEL_PEERS) continue;
 
                 connman.ReleaseNodeVector(vNodesCopy);
                 return; //this will cause each peer to get one request each six seconds for the various assets we need
@@ -319,12 +413,16 @@ void CMasternodeSync::ProcessTick(CConnman& connman)
 
                 if(pnode->nVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
                 nRequestedMasternodeAttempt++;
+                AddPeerAsked(pnode->id);
 
                 // ask node for all payment votes it has (new nodes will only return votes for future payments)
                 connman.PushMessage(pnode, NetMsgType::MASTERNODEPAYMENTSYNC, mnpayments.GetStorageLimit());
                 // ask node for missing pieces only (old nodes will not be asked)
                 mnpayments.RequestLowDataPaymentBlocks(pnode, connman);
 
+                // ask a few more peers in parallel before waiting for the next tick
+                if(++nRequestsThisTick < MASTERNODE_SYNC_PARALLEL_PEERS) continue;
+
                 connman.ReleaseNodeVector(vNodesCopy);
                 return; //this will cause each peer to get one request each six seconds for the various assets we need
             }
@@ -6,6 +6,7 @@
 
 #include "chain.h"
 #include "net.h"
+#include "sync.h"
 
 #include <univalue.h>
 
@@ -22,6 +23,7 @@ static const int MASTERNODE_SYNC_TICK_SECONDS    = 6;
 static const int MASTERNODE_SYNC_TIMEOUT_SECONDS = 30; // our blocks are 2.5 minutes so 30 seconds should be fine
 
 static const int MASTERNODE_SYNC_ENOUGH_PEERS    = 6;
+static const int MASTERNODE_SYNC_PARALLEL_PEERS  = 3; // ask up to that many peers for the current asset on every tick
 
 extern CMasternodeSync masternodeSync;
 
@@ -44,6 +46,34 @@ private:
     // ... or failed
     int64_t nTimeLastFailure;
 
+    // Progress of every asset since the blockchain got synced, reported by "mnsync status"
+    struct CAssetStats {
+        int64_t nTimeStarted;
+        int64_t nTimeFinished;
+        // peers we requested the asset from / which answered with a status count
+        std::set<NodeId> setPeersAsked;
+        std::set<NodeId> setPeersReported;
+        // reported peers which sent all of the asset with their answer
+        int nPeersDone;
+        // items peers said they sent us / items we actually processed
+        int nItemsAnnounced;
+        int nItemsReceived;
+
+        CAssetStats() :
+            nTimeStarted(0),
+            nTimeFinished(0),
+            nPeersDone(0),
+            nItemsAnnounced(0),
+            nItemsReceived(0)
+            {}
+    };
+
+    mutable CCriticalSection cs_stats;
+    std::map<int, CAssetStats> mapAssetStats;
+
+    int GetPeersDone(int nAsset);
+    void AddPeerAsked(NodeId nodeid);
+
     void Fail();
     void ClearFulfilledRequests(CConnman& connman);
 
@@ -60,8 +90,11 @@ public:
     int GetAssetID() { return nRequestedMasternodeAssets; }
     int GetAttempt() { return nRequestedMasternodeAttempt; }
     void BumpAssetLastTime(std::string strFuncName);
+    void AddItemReceived(int nAsset);
     int64_t GetAssetStartTime() { return nTimeAssetSyncStarted; }
     std::string GetAssetName();
+    static std::string GetAssetName(int nAsset);
+    UniValue GetAssetStats();
     std::string GetSyncStatus();
 
     void Reset();
@@ -35,6 +35,7 @@ CMasternode::CMasternode(CService addr, CPubKey pubKeyMasternode,
 
 CMasternode::CMasternode(const CMasternode& other) :
     masternode_info_t{other},
+    fCollateralChecked(other.fCollateralChecked),
     lastPing(other.lastPing),
     vchSig(other.vchSig),
     nCollateralMinConfBlockHash(other.nCollateralMinConfBlockHash),
@@ -70,7 +71,7 @@ bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb, CConnman& co
     int nDos = 0;
     if (mnb.lastPing == CMasternodePing() || (mnb.lastPing != CMasternodePing() && (fMasterNodesReleased ? mnb.lastPing.CheckAndUpdateMnRel(this, true, nDos, connman) : mnb.lastPing.CheckAndUpdate(this, true, nDos, connman)))) {
         lastPing = mnb.lastPing;
-        mnodeman.mapSeenMasternodePing.insert(std::make_pair(lastPing.GetHash(), lastPing));
+        mnodeman.AddSeenPing(lastPing);
     }
     // if it matches our Masternode privkey...
     if (fMasterNode && pubKeyMasternode == activeMasternode.pubKeyMasternode) {
@@ -175,26 +176,36 @@ void CMasternode::CheckMnRel(bool fForce)
     int nHeight = 0;
 
     if (!fUnitTest) {
-        TRY_LOCK(cs_main, lockMain);
-        if (!lockMain) return;
+        if (!fCollateralChecked) {
+            // look the collateral up only once, mnodeman follows its spends in connected blocks afterwards
+            TRY_LOCK(cs_main, lockMain);
+            if (!lockMain) return;
 
-        CollateralStatus err = CheckCollateral(vin.prevout);
+            CollateralStatus err = CheckCollateral(vin.prevout);
 
-        if (err == COLLATERAL_UTXO_NOT_FOUND) {
-            nActiveState = MASTERNODE_OUTPOINT_SPENT;
-            LogPrint("masternode", "CMasternode::CheckMnRel -- Failed to find Masternode UTXO, masternode=%s\n", vin.prevout.ToStringShort());
+            if (err == COLLATERAL_UTXO_NOT_FOUND) {
+                nActiveState = MASTERNODE_OUTPOINT_SPENT;
+                LogPrint("masternode", "CMasternode::CheckMnRel -- Failed to find Masternode UTXO, masternode=%s\n", vin.prevout.ToStringShort());
 
-            return;
-        }
+                return;
+            }
 
-        if (err == COLLATERAL_INVALID_AMOUNT) {
+            if (err == COLLATERAL_INVALID_AMOUNT) {
+                nActiveState = MASTERNODE_OUTPOINT_SPENT;
+                LogPrint("masternode", "CMasternode::CheckMnRel -- Masternode UTXO should have %d FUTURO, masternode=%s\n", MNODE_REQ_BALANCE, vin.prevout.ToStringShort());
+
+                return;
+            }
+
+            fCollateralChecked = true;
+        } else if (mnodeman.IsCollateralSpent(vin.prevout)) {
             nActiveState = MASTERNODE_OUTPOINT_SPENT;
-            LogPrint("masternode", "CMasternode::CheckMnRel -- Masternode UTXO should have %d FUTURO, masternode=%s\n", MNODE_REQ_BALANCE, vin.prevout.ToStringShort());
+            LogPrint("masternode", "CMasternode::CheckMnRel -- Masternode UTXO was spent, masternode=%s\n", vin.prevout.ToStringShort());
 
             return;
         }
 
-        nHeight = chainActive.Height();
+        nHeight = mnodeman.GetCachedBlockHeight();
     }
 
     if (IsPoSeBanned()) {
@@ -453,8 +464,6 @@ void CMasternode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScan
 {
     if(!pindex) return;
 
-    const CBlockIndex *BlockReading = pindex;
-
     // ToDo: FIX IT
     CScript mnpayee;
 
@@ -468,34 +477,21 @@ void CMasternode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScan
 
     LOCK(cs_mapMasternodeBlocks);
 
-    for (int i = 0; BlockReading && BlockReading->nHeight > nBlockLastPaid && i < nMaxBlocksToScanBack; i++) {
-        if(mnpayments.mapMasternodeBlocks.count(BlockReading->nHeight) &&
-            mnpayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2))
-        {
-            CBlock block;
-            if(!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
-                continue;
-
-            CAmount nMasternodePayment = GetMasternodePayment(BlockReading->nHeight, block.vtx[0].GetValueOut());
-
-            BOOST_FOREACH(CTxOut txout, block.vtx[0].vout)
-                if (mnpayee == txout.scriptPubKey && nMasternodePayment == txout.nValue) {
-                    nBlockLastPaid = BlockReading->nHeight;
-                    nTimeLastPaid = BlockReading->nTime;
-
-                    if (fMasterNodesReleased) {
-                        // SPORK_14_MNODES_RELEASE_ENABLED active
-                        LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", vin.prevout.ToStringShort(), nBlockLastPaid);
-                    } else {
-                        LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", payee.ToString(), nBlockLastPaid);
-                    }
-
-                    return;
-                }
+    int nHeightPaid;
+    int64_t nTimePaid;
+    int nMinHeight = std::max(nBlockLastPaid, pindex->nHeight - nMaxBlocksToScanBack);
+    if (mnpayments.payeeIndex.GetLastPaid(mnpayee, pindex, nMinHeight, 2, mnpayments.mapMasternodeBlocks, nHeightPaid, nTimePaid)) {
+        nBlockLastPaid = nHeightPaid;
+        nTimeLastPaid = nTimePaid;
+
+        if (fMasterNodesReleased) {
+            // SPORK_14_MNODES_RELEASE_ENABLED active
+            LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", vin.prevout.ToStringShort(), nBlockLastPaid);
+        } else {
+            LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", payee.ToString(), nBlockLastPaid);
         }
 
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
+        return;
     }
 
     // Last payment for this masternode wasn't found in latest mnpayments blocks
@@ -828,6 +824,7 @@ bool CMasternodeBroadcast::UpdateMnRel(CMasternode* pmn, int& nDos, CConnman& co
             Relay(connman);
         }
         masternodeSync.BumpAssetLastTime("CMasternodeBroadcast::UpdateMnRel");
+        masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
     }
 
     return true;
@@ -885,6 +882,7 @@ bool CMasternodeBroadcast::Update(CMasternode* pmn, int& nDos, CConnman& connman
         }
 
         masternodeSync.BumpAssetLastTime("CMasternodeBroadcast::Update");
+        masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
     }
 
     return true;
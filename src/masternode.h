@@ -158,6 +158,9 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
+    // collateral was found in the UTXO set, spends are reported by mnodeman since then
+    bool fCollateralChecked{};
+
 public:
     enum state {
         MASTERNODE_PRE_ENABLED,
@@ -293,8 +296,8 @@ public:
     std::string GetStateString() const;
     std::string GetStatus() const;
 
-    int GetLastPaidTime() { return nTimeLastPaid; }
-    int GetLastPaidBlock() { return nBlockLastPaid; }
+    int GetLastPaidTime() const { return nTimeLastPaid; }
+    int GetLastPaidBlock() const { return nBlockLastPaid; }
     void UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack);
 
     CMasternode& operator=(CMasternode const& from)
@@ -307,6 +310,7 @@ public:
         nPoSeBanScore = from.nPoSeBanScore;
         nPoSeBanHeight = from.nPoSeBanHeight;
         fUnitTest = from.fUnitTest;
+        fCollateralChecked = from.fCollateralChecked;
         return *this;
     }
 };
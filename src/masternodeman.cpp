@@ -61,6 +61,11 @@ CMasternodeMan::CMasternodeMan()
   listScheduledMnbRequestConnections(),
   fMasternodesAdded(false),
   fMasternodesRemoved(false),
+  cs_snapshot(),
+  snapshotMnRel(),
+  snapshot(),
+  nTimeSnapshotMnRel(0),
+  nTimeSnapshot(0),
   mapSeenMasternodeBroadcast(),
   mapSeenMasternodePing()
 {}
@@ -75,7 +80,10 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
         LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
         mapMasternodesMnRel[mn.vin.prevout] = mn;
+        AddPayeeMnRel(mn);
+        WatchCollateral(mn.vin.prevout);
         fMasternodesAdded = true;
+        InvalidateSnapshots();
 
         return true;
     }
@@ -84,7 +92,9 @@ bool CMasternodeMan::Add(CMasternode &mn)
         return false;
     } else {
         mapMasternodes[mn.pubKeyMasternode] = mn;
+        AddPayee(mn);
         fMasternodesAdded = true;
+        InvalidateSnapshots();
     }
 
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n",
@@ -227,24 +237,19 @@ void CMasternodeMan::CheckAndRemoveMnRel(CConnman& connman)
         int nAskForMnbRecovery = MNB_RECOVERY_MAX_ASK_ENTRIES;
         std::map<COutPoint, CMasternode>::iterator it = mapMasternodesMnRel.begin();
         while (it != mapMasternodesMnRel.end()) {
-            CMasternodeBroadcast mnb = CMasternodeBroadcast(it->second);
-            uint256 hash = mnb.GetHash();
             // If collateral was spent ...
             if (it->second.IsOutpointSpent()) {
                 LogPrint("masternode", "CMasternodeMan::CheckAndRemoveMnRel -- Removing Masternode: %s  addr=%s  %i now\n", it->second.GetStateString(), it->second.addr.ToString(), size() - 1);
-
-                // erase all of the broadcasts we've seen from this txin, ...
-                mapSeenMasternodeBroadcast.erase(hash);
-                mWeAskedForMasternodeListEntryMnRel.erase(it->first);
-
-                // and finally remove it from the list
-                mapMasternodesMnRel.erase(it++);
-                fMasternodesRemoved = true;
+                COutPoint outpoint = it->first;
+                ++it;
+                Remove(outpoint);
             } else {
+                // only hash the broadcast of the masternodes that might need a recovery
+                uint256 hash;
                 bool fAsk = (nAskForMnbRecovery > 0) &&
                             masternodeSync.IsSynced() &&
                             it->second.IsNewStartRequired() &&
-                            !IsMnbRecoveryRequested(hash);
+                            !IsMnbRecoveryRequested(hash = CMasternodeBroadcast(it->second).GetHash());
                 if(fAsk) {
                     // this mn is in a non-recoverable state and we haven't asked other nodes yet
                     std::set<CNetAddr> setRequested;
@@ -360,27 +365,7 @@ void CMasternodeMan::CheckAndRemoveMnRel(CConnman& connman)
 
         // NOTE: do not expire mapSeenMasternodeBroadcast entries here, clean them on mnb updates!
 
-        // remove expired mapSeenMasternodePing
-        std::map<uint256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.begin();
-        while(it4 != mapSeenMasternodePing.end()){
-            if((*it4).second.IsExpired()) {
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemoveMnRel -- Removing expired Masternode ping: hash=%s\n", (*it4).second.GetHash().ToString());
-                mapSeenMasternodePing.erase(it4++);
-            } else {
-                ++it4;
-            }
-        }
-
-        // remove expired mapSeenMasternodeVerification
-        std::map<uint256, CMasternodeVerification>::iterator itv2 = mapSeenMasternodeVerification.begin();
-        while(itv2 != mapSeenMasternodeVerification.end()){
-            if((*itv2).second.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS){
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemoveMnRel -- Removing expired Masternode verification: hash=%s\n", (*itv2).first.ToString());
-                mapSeenMasternodeVerification.erase(itv2++);
-            } else {
-                ++itv2;
-            }
-        }
+        RemoveExpiredSeen();
 
         LogPrintf("CMasternodeMan::CheckAndRemoveMnRel -- %s\n", ToString());
     }
@@ -412,9 +397,6 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
         std::map<CPubKey, CMasternode>::iterator it = mapMasternodes.begin();
 
         while (it != mapMasternodes.end()) {
-            CMasternodeBroadcast mnb = CMasternodeBroadcast(it->second);
-            uint256 hash = mnb.GetHash();
-
             /* It is a good place to check whether a masternode is still on
              * the list propagated with 'mnlist' mechanism.
              */
@@ -422,18 +404,16 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
                 LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- "
                          "remove inactive masternode: %s, addr=%s, size=%i now\n",
                          it->second.GetStateString(), it->second.addr.ToString(), size() - 1);
-
-                // erase all of the broadcasts we've seen from this txin
-                mapSeenMasternodeBroadcast.erase(hash);
-                mWeAskedForMasternodeListEntry.erase(it->first);
-                // and finally remove it from the list
-                mapMasternodes.erase(it++);
-                fMasternodesRemoved = true;
+                CPubKey pubKey = it->first;
+                ++it;
+                Remove(pubKey);
             } else {
                 /* Assume the masternode is valid. */
+                // only hash the broadcast of the masternodes that might need a recovery
+                uint256 hash;
                 bool fAsk = (nAskForMnbRecovery > 0) && masternodeSync.IsSynced() &&
                              it->second.IsNewStartRequired() &&
-                             !IsMnbRecoveryRequested(hash);
+                             !IsMnbRecoveryRequested(hash = CMasternodeBroadcast(it->second).GetHash());
 
                 if (fAsk) {
                     // this mn is in a non-recoverable state and we haven't asked other nodes yet
@@ -564,27 +544,7 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
 
         // NOTE: do not expire mapSeenMasternodeBroadcast entries here, clean them on mnb updates!
 
-        // remove expired mapSeenMasternodePing
-        std::map<uint256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.begin();
-        while(it4 != mapSeenMasternodePing.end()){
-            if((*it4).second.IsExpired()) {
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", (*it4).second.GetHash().ToString());
-                mapSeenMasternodePing.erase(it4++);
-            } else {
-                ++it4;
-            }
-        }
-
-        // remove expired mapSeenMasternodeVerification
-        std::map<uint256, CMasternodeVerification>::iterator itv2 = mapSeenMasternodeVerification.begin();
-        while(itv2 != mapSeenMasternodeVerification.end()){
-            if((*itv2).second.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS){
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode verification: hash=%s\n", (*itv2).first.ToString());
-                mapSeenMasternodeVerification.erase(itv2++);
-            } else {
-                ++itv2;
-            }
-        }
+        RemoveExpiredSeen();
 
         LogPrintf("CMasternodeMan::CheckAndRemove -- %s\n", ToString());
     }
@@ -594,17 +554,64 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
     }
 }
 
+// SPORK_14_MNODES_RELEASE_ENABLED active
+void CMasternodeMan::Remove(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    auto it = mapMasternodesMnRel.find(outpoint);
+    if (it == mapMasternodesMnRel.end()) {
+        return;
+    }
+
+    // erase all of the broadcasts we've seen from this txin, ...
+    mapSeenMasternodeBroadcast.erase(CMasternodeBroadcast(it->second).GetHash());
+    mWeAskedForMasternodeListEntryMnRel.erase(outpoint);
+
+    // and finally remove it from the list
+    ErasePayeeMnRel(it->second);
+    UnwatchCollateral(outpoint);
+    mapMasternodesMnRel.erase(it);
+    fMasternodesRemoved = true;
+    InvalidateSnapshots();
+}
+
+void CMasternodeMan::Remove(const CPubKey& pubKey)
+{
+    LOCK(cs);
+    auto it = mapMasternodes.find(pubKey);
+    if (it == mapMasternodes.end()) {
+        return;
+    }
+
+    // erase all of the broadcasts we've seen from this txin
+    mapSeenMasternodeBroadcast.erase(CMasternodeBroadcast(it->second).GetHash());
+    mWeAskedForMasternodeListEntry.erase(pubKey);
+    // and finally remove it from the list
+    ErasePayee(it->second);
+    mapMasternodes.erase(it);
+    fMasternodesRemoved = true;
+    InvalidateSnapshots();
+}
+
 void CMasternodeMan::Clear()
 {
     LOCK(cs);
     mapMasternodesMnRel.clear();
     mapMasternodes.clear();
+    mapPayeesMnRel.clear();
+    mapPayees.clear();
+    InvalidateSnapshots();
+    {
+        LOCK(cs_collaterals);
+        mapCollaterals.clear();
+    }
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntryMnRel.clear();
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
+    mapSeenMasternodePingBySigTime.clear();
 }
 
 int CMasternodeMan::CountMasternodes(int nProtocolVersion)
@@ -668,7 +675,59 @@ int CMasternodeMan::CountByIP(int nNetworkType)
 }
 */
 
-void CMasternodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
+bool CMasternodeMan::ReadMnbBatch(CDataStream& vRecv, std::vector<CMasternodeBroadcast>& vecMnb)
+{
+    // check the size before allocating anything for the entries
+    uint64_t nSize = ReadCompactSize(vRecv);
+    if (nSize > (uint64_t)MNB_BATCH_SIZE)
+        return false;
+
+    vecMnb.resize(nSize);
+    for (auto& mnb : vecMnb)
+        vRecv >> mnb;
+    return true;
+}
+
+void CMasternodeMan::AddToMnbBatch(CNode* pnode, std::vector<CMasternodeBroadcast>& vecMnb, const CMasternodeBroadcast& mnb, CConnman& connman)
+{
+    vecMnb.push_back(mnb);
+    if ((int)vecMnb.size() == MNB_BATCH_SIZE) {
+        connman.PushMessage(pnode, NetMsgType::MNANNOUNCEBATCH, vecMnb);
+        vecMnb.clear();
+    }
+}
+
+void CMasternodeMan::FinishDsegReply(CNode* pnode, const std::vector<CMasternodeBroadcast>& vecMnb, int nCount, bool fBatch, CConnman& connman)
+{
+    if (!vecMnb.empty()) {
+        connman.PushMessage(pnode, NetMsgType::MNANNOUNCEBATCH, vecMnb);
+    }
+    connman.PushMessage(pnode, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nCount);
+    if (fBatch) {
+        LogPrintf("DSEG -- Sent %d Masternode broadcasts in batches to peer %d\n", nCount, pnode->id);
+    } else {
+        LogPrintf("DSEG -- Sent %d Masternode invs to peer %d\n", nCount, pnode->id);
+    }
+}
+
+bool CMasternodeMan::ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb, CConnman& connman)
+{
+    int nDos = 0;
+
+    bool fUpdated = fMasterNodesReleased ? CheckMnbAndUpdateMasternodeListMnRel(pfrom, mnb, nDos, connman)
+                                         : CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos, connman);
+    if (fUpdated) {
+        // use announced Masternode as a peer
+        connman.AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
+    } else if(nDos > 0) {
+        Misbehaving(pfrom->GetId(), nDos);
+        return false;
+    }
+
+    return true;
+}
+
+bool CMasternodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
 {
     LOCK(cs);
 
@@ -677,7 +736,7 @@ void CMasternodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
             std::map<CNetAddr, int64_t>::iterator it = mWeAskedForMasternodeList.find(pnode->addr);
             if(it != mWeAskedForMasternodeList.end() && GetTime() < (*it).second) {
                 LogPrintf("CMasternodeMan::DsegUpdate -- we already asked %s for the list; skipping...\n", pnode->addr.ToString());
-                return;
+                return false;
             }
         }
     }
@@ -687,6 +746,7 @@ void CMasternodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 
     LogPrint("masternode", "CMasternodeMan::DsegUpdate -- asked %s for the list\n", pnode->addr.ToString());
+    return true;
 }
 
 // SPORK_14_MNODES_RELEASE_ENABLED active
@@ -700,12 +760,59 @@ CMasternode* CMasternodeMan::Find(const COutPoint &outpoint)
 CMasternode* CMasternodeMan::Find(const CPubKey& pubKey)
 {
     LOCK(cs);
+    // entries are keyed by their pubKeyMasternode
+    auto it = mapMasternodes.find(pubKey);
+    return it == mapMasternodes.end() ? NULL : &(it->second);
+}
+
+// SPORK_14_MNODES_RELEASE_ENABLED active
+void CMasternodeMan::AddPayeeMnRel(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    mapPayeesMnRel[GetScriptForDestination(mn.pubKeyCollateralAddress.GetID())].insert(mn.vin.prevout);
+}
+
+void CMasternodeMan::AddPayee(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    mapPayees[GetScriptForDestination(mn.pubKeyMasternode.GetID())] = mn.pubKeyMasternode;
+}
+
+// SPORK_14_MNODES_RELEASE_ENABLED active
+void CMasternodeMan::ErasePayeeMnRel(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    auto it = mapPayeesMnRel.find(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()));
+    if (it == mapPayeesMnRel.end()) {
+        return;
+    }
+    it->second.erase(mn.vin.prevout);
+    if (it->second.empty()) {
+        mapPayeesMnRel.erase(it);
+    }
+}
+
+void CMasternodeMan::ErasePayee(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    auto it = mapPayees.find(GetScriptForDestination(mn.pubKeyMasternode.GetID()));
+    if (it != mapPayees.end() && it->second == mn.pubKeyMasternode) {
+        mapPayees.erase(it);
+    }
+}
+
+void CMasternodeMan::RebuildPayees()
+{
+    AssertLockHeld(cs);
+    // both maps are kept in sync, SPORK_14_MNODES_RELEASE_ENABLED can switch at any time
+    mapPayeesMnRel.clear();
+    mapPayees.clear();
+    for (auto& mnpair : mapMasternodesMnRel) {
+        AddPayeeMnRel(mnpair.second);
+    }
     for (auto& mnpair : mapMasternodes) {
-        if (mnpair.second.pubKeyMasternode == pubKey) {
-            return &mnpair.second;
-        }
+        AddPayee(mnpair.second);
     }
-    return NULL;
 }
 
 // SPORK_14_MNODES_RELEASE_ENABLED active
@@ -763,41 +870,45 @@ bool CMasternodeMan::GetMasternodeInfoMnRel(const CPubKey& pubKeyMasternode, mas
 bool CMasternodeMan::GetMasternodeInfo(const CPubKey& pubKeyMasternode, masternode_info_t& mnInfoRet)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodes) {
-        if (mnpair.second.pubKeyMasternode == pubKeyMasternode) {
-            mnInfoRet = mnpair.second.GetInfo();
-            return true;
-        }
+    auto it = mapMasternodes.find(pubKeyMasternode);
+    if (it == mapMasternodes.end()) {
+        return false;
     }
-    return false;
+    mnInfoRet = it->second.GetInfo();
+    return true;
 }
 
 // SPORK_14_MNODES_RELEASE_ENABLED active
 bool CMasternodeMan::GetMasternodeInfoMnRel(const CScript& payee, masternode_info_t& mnInfoRet)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodesMnRel) {
-        CScript scriptCollateralAddress = GetScriptForDestination(mnpair.second.pubKeyCollateralAddress.GetID());
-        if (scriptCollateralAddress == payee) {
-            mnInfoRet = mnpair.second.GetInfo();
-            return true;
-        }
+    // several masternodes can share a collateral address, pick the first one like a full scan would
+    auto itPayee = mapPayeesMnRel.find(payee);
+    if (itPayee == mapPayeesMnRel.end()) {
+        return false;
     }
-    return false;
+    auto it = mapMasternodesMnRel.find(*itPayee->second.begin());
+    if (it == mapMasternodesMnRel.end()) {
+        return false;
+    }
+    mnInfoRet = it->second.GetInfo();
+    return true;
 }
 
 // ToDO: FIX IT
 bool CMasternodeMan::GetMasternodeInfo(const CScript& payee, masternode_info_t& mnInfoRet)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodes) {
-        CScript scriptCollateralAddress = GetScriptForDestination(mnpair.second.pubKeyMasternode.GetID());
-        if (scriptCollateralAddress == payee) {
-            mnInfoRet = mnpair.second.GetInfo();
-            return true;
-        }
+    auto itPayee = mapPayees.find(payee);
+    if (itPayee == mapPayees.end()) {
+        return false;
     }
-    return false;
+    auto it = mapMasternodes.find(itPayee->second);
+    if (it == mapMasternodes.end()) {
+        return false;
+    }
+    mnInfoRet = it->second.GetInfo();
+    return true;
 }
 
 // SPORK_14_MNODES_RELEASE_ENABLED active
@@ -1082,6 +1193,162 @@ bool CMasternodeMan::GetMasternodeRank(const CPubKey &pubKey, int& nRankRet, int
     return false;
 }
 
+bool CMasternodeMan::AddSeenPing(const CMasternodePing& mnp)
+{
+    LOCK(cs);
+    uint256 hash = mnp.GetHash();
+    if (!mapSeenMasternodePing.insert(std::make_pair(hash, mnp)).second) {
+        return false;
+    }
+    mapSeenMasternodePingBySigTime.insert(std::make_pair(mnp.sigTime, hash));
+    return true;
+}
+
+bool CMasternodeMan::AddSeenVerification(const CMasternodeVerification& mnv)
+{
+    LOCK(cs);
+    uint256 hash = mnv.GetHash();
+    if (!mapSeenMasternodeVerification.insert(std::make_pair(hash, mnv)).second) {
+        return false;
+    }
+    mapSeenMasternodeVerificationByHeight.insert(std::make_pair(mnv.nBlockHeight, hash));
+    return true;
+}
+
+void CMasternodeMan::RemoveExpiredSeen()
+{
+    AssertLockHeld(cs);
+
+    // remove expired mapSeenMasternodePing, same as CMasternodePing::IsExpired()
+    int64_t nExpiredSigTime = GetAdjustedTime() - MASTERNODE_NEW_START_REQUIRED_SECONDS;
+    std::multimap<int64_t, uint256>::iterator it4 = mapSeenMasternodePingBySigTime.begin();
+    while (it4 != mapSeenMasternodePingBySigTime.end() && it4->first < nExpiredSigTime) {
+        LogPrint("masternode", "CMasternodeMan::RemoveExpiredSeen -- Removing expired Masternode ping: hash=%s\n", it4->second.ToString());
+        mapSeenMasternodePing.erase(it4->second);
+        mapSeenMasternodePingBySigTime.erase(it4++);
+    }
+
+    // remove expired mapSeenMasternodeVerification
+    std::multimap<int, uint256>::iterator itv2 = mapSeenMasternodeVerificationByHeight.begin();
+    while (itv2 != mapSeenMasternodeVerificationByHeight.end() && itv2->first < nCachedBlockHeight - MAX_POSE_BLOCKS) {
+        LogPrint("masternode", "CMasternodeMan::RemoveExpiredSeen -- Removing expired Masternode verification: hash=%s\n", itv2->second.ToString());
+        mapSeenMasternodeVerification.erase(itv2->second);
+        mapSeenMasternodeVerificationByHeight.erase(itv2++);
+    }
+}
+
+void CMasternodeMan::WatchCollateral(const COutPoint& outpoint)
+{
+    LOCK(cs_collaterals);
+    mapCollaterals[outpoint] = false;
+}
+
+void CMasternodeMan::UnwatchCollateral(const COutPoint& outpoint)
+{
+    LOCK(cs_collaterals);
+    mapCollaterals.erase(outpoint);
+}
+
+void CMasternodeMan::ConnectBlock(const CBlock& block)
+{
+    LOCK(cs_collaterals);
+
+    if (mapCollaterals.empty()) return;
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                std::map<COutPoint, bool>::iterator it = mapCollaterals.find(txin.prevout);
+                if (it != mapCollaterals.end()) {
+                    LogPrint("masternode", "CMasternodeMan::ConnectBlock -- collateral %s spent by %s\n", txin.prevout.ToStringShort(), tx.GetHash().ToString());
+                    it->second = true;
+                }
+            }
+        }
+        // collateral created again by a block that was disconnected before
+        const uint256& txid = tx.GetHash();
+        std::map<COutPoint, bool>::iterator it = mapCollaterals.lower_bound(COutPoint(txid, 0));
+        for (; it != mapCollaterals.end() && it->first.hash == txid; ++it) {
+            it->second = false;
+        }
+    }
+}
+
+void CMasternodeMan::DisconnectBlock(const CBlock& block)
+{
+    LOCK(cs_collaterals);
+
+    if (mapCollaterals.empty()) return;
+
+    BOOST_REVERSE_FOREACH(const CTransaction& tx, block.vtx) {
+        // collateral created by this block is gone
+        const uint256& txid = tx.GetHash();
+        std::map<COutPoint, bool>::iterator it = mapCollaterals.lower_bound(COutPoint(txid, 0));
+        for (; it != mapCollaterals.end() && it->first.hash == txid; ++it) {
+            it->second = true;
+        }
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                std::map<COutPoint, bool>::iterator it2 = mapCollaterals.find(txin.prevout);
+                if (it2 != mapCollaterals.end()) {
+                    it2->second = false;
+                }
+            }
+        }
+    }
+}
+
+bool CMasternodeMan::IsCollateralSpent(const COutPoint& outpoint)
+{
+    LOCK(cs_collaterals);
+    std::map<COutPoint, bool>::const_iterator it = mapCollaterals.find(outpoint);
+    return it != mapCollaterals.end() && it->second;
+}
+
+void CMasternodeMan::InvalidateSnapshots()
+{
+    LOCK(cs_snapshot);
+    snapshotMnRel.reset();
+    snapshot.reset();
+}
+
+// SPORK_14_MNODES_RELEASE_ENABLED active
+CMasternodeMan::snapshot_mnrel_t CMasternodeMan::GetFullMasternodeMapMnRel()
+{
+    {
+        LOCK(cs_snapshot);
+        if (snapshotMnRel && GetTime() - nTimeSnapshotMnRel < MASTERNODE_CHECK_SECONDS) {
+            return snapshotMnRel;
+        }
+    }
+
+    // copy outside of cs_snapshot so that readers picking up the old one are never blocked
+    LOCK(cs);
+    snapshot_mnrel_t snapshotNew = std::make_shared<const std::map<COutPoint, CMasternode> >(mapMasternodesMnRel);
+    LOCK(cs_snapshot);
+    snapshotMnRel = snapshotNew;
+    nTimeSnapshotMnRel = GetTime();
+    return snapshotNew;
+}
+
+CMasternodeMan::snapshot_t CMasternodeMan::GetFullMasternodeMap()
+{
+    {
+        LOCK(cs_snapshot);
+        if (snapshot && GetTime() - nTimeSnapshot < MASTERNODE_CHECK_SECONDS) {
+            return snapshot;
+        }
+    }
+
+    // copy outside of cs_snapshot so that readers picking up the old one are never blocked
+    LOCK(cs);
+    snapshot_t snapshotNew = std::make_shared<const std::map<CPubKey, CMasternode> >(mapMasternodes);
+    LOCK(cs_snapshot);
+    snapshot = snapshotNew;
+    nTimeSnapshot = GetTime();
+    return snapshotNew;
+}
+
 bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMasternodeRanksRet, int nBlockHeight, int nMinProtocol)
 {
     vecMasternodeRanksRet.clear();
@@ -1205,25 +1472,37 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             LogPrint("masternode", "MNANNOUNCE -- Masternode announce, masternode=%s\n", mnb.pubKeyMasternode.GetID().ToString());
         }
 
-        int nDos = 0;
+        ProcessBroadcast(pfrom, mnb, connman);
 
-        if (fMasterNodesReleased) {
-            // SPORK_14_MNODES_RELEASE_ENABLED active
-            if (CheckMnbAndUpdateMasternodeListMnRel(pfrom, mnb, nDos, connman)) {
-                // use announced Masternode as a peer
-                connman.AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
-            } else if(nDos > 0) {
-                Misbehaving(pfrom->GetId(), nDos);
-            }
-        } else {
-            if (CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos, connman)) {
-                // use announced Masternode as a peer
-                connman.AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
-            } else if(nDos > 0) {
-                Misbehaving(pfrom->GetId(), nDos);
+        if(fMasternodesAdded) {
+            NotifyMasternodeUpdates(connman);
+        }
+    } else if (strCommand == NetMsgType::MNANNOUNCEBATCH) { //Masternode list, reply to dseg
+
+        {
+            LOCK(cs);
+            if (!mWeAskedForMasternodeList.count(pfrom->addr)) {
+                // we didn't ask for the list
+                Misbehaving(pfrom->GetId(), 20);
+                return;
             }
         }
 
+        std::vector<CMasternodeBroadcast> vecMnb;
+        if (!ReadMnbBatch(vRecv, vecMnb)) {
+            LogPrintf("MNANNOUNCEBATCH -- oversized batch, peer=%d\n", pfrom->id);
+            Misbehaving(pfrom->GetId(), 20);
+            return;
+        }
+
+        LogPrint("masternode", "MNANNOUNCEBATCH -- %d Masternode announces, peer=%d\n", vecMnb.size(), pfrom->id);
+
+        // every broadcast carries its own signatures, apply them one by one
+        // and stop at the first one the peer gets punished for
+        for (auto& mnb : vecMnb) {
+            if (!ProcessBroadcast(pfrom, mnb, connman)) break;
+        }
+
         if(fMasternodesAdded) {
             NotifyMasternodeUpdates(connman);
         }
@@ -1246,8 +1525,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         // Need LOCK2 here to ensure consistent locking order because the CheckAndUpdate call below locks cs_main
         LOCK2(cs_main, cs);
 
-        if (mapSeenMasternodePing.count(nHash)) return; //seen
-        mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+        if (!AddSeenPing(mnp)) return; //seen
 
         CMasternode* pmn;
 
@@ -1345,6 +1623,9 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         int nInvCount = 0;
+        // newer peers get the whole list in a few messages instead of two invs per masternode
+        bool fBatch = (fMasterNodesReleased ? vin == CTxIn() : pubkey == CPubKey()) && pfrom->nVersion >= MNB_BATCH_VERSION;
+        std::vector<CMasternodeBroadcast> vecMnb;
 
         if (fMasterNodesReleased) {
             // SPORK_14_MNODES_RELEASE_ENABLED active
@@ -1355,6 +1636,11 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
                 LogPrint("masternode", "DSEG -- Sending Masternode entry: masternode=%s  addr=%s\n", mnpair.first.ToStringShort(), mnpair.second.addr.ToString());
                 CMasternodeBroadcast mnb = CMasternodeBroadcast(mnpair.second);
+                if (fBatch) {
+                    AddToMnbBatch(pfrom, vecMnb, mnb, connman);
+                    nInvCount++;
+                    continue;
+                }
                 uint256 hash = mnb.GetHash();
                 pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
                 pfrom->PushInventory(CInv(MSG_MASTERNODE_PING, mnpair.second.lastPing.GetHash()));
@@ -1371,8 +1657,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             }
 
             if(vin == CTxIn()) {
-                connman.PushMessage(pfrom, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount);
-                LogPrintf("DSEG -- Sent %d Masternode invs to peer %d\n", nInvCount, pfrom->id);
+                FinishDsegReply(pfrom, vecMnb, nInvCount, fBatch, connman);
                 return;
             }
             // smth weird happen - someone asked us for vin we have no idea about?
@@ -1385,6 +1670,11 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 LogPrint("masternode", "DSEG -- Sending Masternode entry: masternode=%s  addr=%s\n",
                          mnpair.first.GetID().ToString(), mnpair.second.addr.ToString());
                 CMasternodeBroadcast mnb = CMasternodeBroadcast(mnpair.second);
+                if (fBatch) {
+                    AddToMnbBatch(pfrom, vecMnb, mnb, connman);
+                    nInvCount++;
+                    continue;
+                }
                 CMasternodePing mnp = mnpair.second.lastPing;
                 uint256 hashMNB = mnb.GetHash();
                 uint256 hashMNP = mnp.GetHash();
@@ -1394,7 +1684,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 nInvCount++;
 
                 mapSeenMasternodeBroadcast.insert(std::make_pair(hashMNB, std::make_pair(GetTime(), mnb)));
-                mapSeenMasternodePing.insert(std::make_pair(hashMNP, mnp));
+                AddSeenPing(mnp);
 
                 if (pubkey == mnpair.first) {
                     LogPrintf("DSEG -- Sent 1 Masternode inv to peer %d\n", pfrom->id);
@@ -1403,8 +1693,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             }
 
             if (pubkey == CPubKey()) {
-                connman.PushMessage(pfrom, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount);
-                LogPrintf("DSEG -- Sent %d Masternode invs to peer %d\n", nInvCount, pfrom->id);
+                FinishDsegReply(pfrom, vecMnb, nInvCount, fBatch, connman);
                 return;
             }
             // smth weird happen - someone asked us for pubkey we have no idea about?
@@ -1751,7 +2040,7 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
                     }
 
                     mWeAskedForVerification[pnode->addr] = mnv;
-                    mapSeenMasternodeVerification.insert(std::make_pair(mnv.GetHash(), mnv));
+                    AddSeenVerification(mnv);
                     mnv.Relay();
 
                 } else {
@@ -1784,11 +2073,10 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 {
     std::string strError;
 
-    if(mapSeenMasternodeVerification.find(mnv.GetHash()) != mapSeenMasternodeVerification.end()) {
+    if(!AddSeenVerification(mnv)) {
         // we already have one
         return;
     }
-    mapSeenMasternodeVerification[mnv.GetHash()] = mnv;
 
     // we don't care about history
     if(mnv.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS) {
@@ -1970,7 +2258,7 @@ std::string CMasternodeMan::ToString() const
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb, CConnman& connman)
 {
     LOCK2(cs_main, cs);
-    mapSeenMasternodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
+    AddSeenPing(mnb.lastPing);
     mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), std::make_pair(GetTime(), mnb)));
 
     LogPrintf("CMasternodeMan::UpdateMasternodeList -- masternode=%s  addr=%s\n", fMasterNodesReleased ? mnb.vin.prevout.ToStringShort() : mnb.pubKeyMasternode.GetID().ToString(), mnb.addr.ToString());
@@ -1987,11 +2275,13 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb, CConnman& co
     if (pmn == NULL) {
         if (Add(mnb)) {
             masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - new");
+            masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
         }
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
         if (pmn->UpdateFromNewBroadcast(mnb, connman)) {
             masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - seen");
+            masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
         }
     }
@@ -2067,6 +2357,7 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeListMnRel(CNode* pfrom, CMastern
     if(mnb.CheckOutpoint(nDos)) {
         Add(mnb);
         masternodeSync.BumpAssetLastTime("CMasternodeMan::CheckMnbAndUpdateMasternodeListMnRel - new");
+        masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
         // if it matches our Masternode privkey...
         if(fMasterNode && mnb.pubKeyMasternode == activeMasternode.pubKeyMasternode) {
             mnb.nPoSeBanScore = -MASTERNODE_POSE_BAN_MAX_SCORE;
@@ -2170,6 +2461,7 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
     if (mnb.CheckMasternode(nDos)) {
         Add(mnb);
         masternodeSync.BumpAssetLastTime("CMasternodeMan::CheckMnbAndUpdateMasternodeList - new");
+        masternodeSync.AddItemReceived(MASTERNODE_SYNC_LIST);
         // if it matches our Masternode privkey...
         if (fMasterNode && mnb.pubKeyMasternode == activeMasternode.pubKeyMasternode) {
             mnb.nPoSeBanScore = -MASTERNODE_POSE_BAN_MAX_SCORE;
@@ -2210,9 +2502,16 @@ void CMasternodeMan::UpdateLastPaidMnRel(const CBlockIndex* pindex)
     // LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
     //                         nCachedBlockHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
 
+    {
+        // read every block with payment votes once, instead of once per masternode
+        LOCK(cs_mapMasternodeBlocks);
+        mnpayments.payeeIndex.Fill(pindex, nMaxBlocksToScanBack, mnpayments.mapMasternodeBlocks);
+    }
+
     for (auto& mnpair: mapMasternodesMnRel) {
         mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
     }
+    InvalidateSnapshots();
 
     IsFirstRun = false;
 }
@@ -2231,9 +2530,16 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
     // LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
     //                         nCachedBlockHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
 
+    {
+        // read every block with payment votes once, instead of once per masternode
+        LOCK(cs_mapMasternodeBlocks);
+        mnpayments.payeeIndex.Fill(pindex, nMaxBlocksToScanBack, mnpayments.mapMasternodeBlocks);
+    }
+
     for (auto& mnpair: mapMasternodes) {
         mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
     }
+    InvalidateSnapshots();
 
     IsFirstRun = false;
 }
@@ -2287,7 +2593,7 @@ void CMasternodeMan::SetMasternodeLastPing(const COutPoint& outpoint, const CMas
         return;
     }
     pmn->lastPing = mnp;
-    mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+    AddSeenPing(mnp);
 
     CMasternodeBroadcast mnb(*pmn);
     uint256 hash = mnb.GetHash();
@@ -2304,7 +2610,7 @@ void CMasternodeMan::SetMasternodeLastPing(const CPubKey& pubKey, const CMastern
         return;
     }
     pmn->lastPing = mnp;
-    mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+    AddSeenPing(mnp);
 
     CMasternodeBroadcast mnb(*pmn);
     uint256 hash = mnb.GetHash();
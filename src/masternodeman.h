@@ -31,11 +31,14 @@ public:
     typedef std::vector<score_pair_t> score_pair_vec_t;
     typedef std::pair<int, CMasternode> rank_pair_t;
     typedef std::vector<rank_pair_t> rank_pair_vec_t;
+    typedef std::shared_ptr<const std::map<COutPoint, CMasternode> > snapshot_mnrel_t;
+    typedef std::shared_ptr<const std::map<CPubKey, CMasternode> > snapshot_t;
 
 private:
     static const std::string SERIALIZATION_VERSION_STRING;
 
     static const int DSEG_UPDATE_SECONDS        = 3 * 60 * 60;
+    static const int MNB_BATCH_SIZE             = 500;
 
     static const int LAST_PAID_SCAN_BLOCKS      = 100;
 
@@ -60,6 +63,12 @@ private:
     // map to hold all MNs
     std::map<COutPoint, CMasternode> mapMasternodesMnRel;
     std::map<CPubKey, CMasternode> mapMasternodes;
+    // payee script of every MN, it never changes for a given entry. Only the
+    // payee lookups done for every block are indexed: addr, pubKeyMasternode (on
+    // the MnRel map) and the protocol version change with every new broadcast,
+    // so those lookups still walk the list or use the snapshots
+    std::map<CScript, std::set<COutPoint> > mapPayeesMnRel;
+    std::map<CScript, CPubKey> mapPayees;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -69,6 +78,15 @@ private:
     std::map<CPubKey, std::map<CNetAddr, int64_t> > mWeAskedForMasternodeListEntry;
     // who we asked for the masternode verification
     std::map<CNetAddr, CMasternodeVerification> mWeAskedForVerification;
+    // seen pings by sigTime and seen verifications by block height, so that
+    // only the entries that actually expired are visited when cleaning up
+    std::multimap<int64_t, uint256> mapSeenMasternodePingBySigTime;
+    std::multimap<int, uint256> mapSeenMasternodeVerificationByHeight;
+
+    // protects mapCollaterals only, taken from ConnectTip/DisconnectTip under cs_main
+    CCriticalSection cs_collaterals;
+    // collaterals of the masternodes in mapMasternodesMnRel, true once spent on the active chain
+    std::map<COutPoint, bool> mapCollaterals;
 
     // these maps are used for masternode recovery from MASTERNODE_NEW_START_REQUIRED state
     std::map<uint256, std::pair< int64_t, std::set<CNetAddr> > > mMnbRecoveryRequests;
@@ -81,14 +99,51 @@ private:
     /// Set when masternodes are removed
     bool fMasternodesRemoved;
 
+    // protects the snapshots below only, never held while copying the list
+    mutable CCriticalSection cs_snapshot;
+    // immutable copies of the list shared by all readers, rebuilt on demand
+    // once entries are added/removed or MASTERNODE_CHECK_SECONDS have passed
+    snapshot_mnrel_t snapshotMnRel;
+    snapshot_t snapshot;
+    int64_t nTimeSnapshotMnRel;
+    int64_t nTimeSnapshot;
+
     friend class CMasternodeSync;
     /// Find an entry
     CMasternode* Find(const COutPoint& outpoint);
     CMasternode* Find(const CPubKey& pubKey);
 
+    /// Keep the payee index in sync with the masternode maps
+    void AddPayeeMnRel(const CMasternode& mn);
+    void AddPayee(const CMasternode& mn);
+    void ErasePayeeMnRel(const CMasternode& mn);
+    void ErasePayee(const CMasternode& mn);
+    void RebuildPayees();
+
+    /// Drop the published snapshots, call after changing the list
+    void InvalidateSnapshots();
+
+    /// Drop seen pings and verifications that are too old, oldest first
+    void RemoveExpiredSeen();
+
+    /// Start/stop following collateral spends of a masternode in mapMasternodesMnRel
+    void WatchCollateral(const COutPoint& outpoint);
+    void UnwatchCollateral(const COutPoint& outpoint);
+
     bool GetMasternodeScores(const uint256& nBlockHash, score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol = 0);
 
+    /// Check and apply a broadcast received from pfrom, returns false if pfrom got punished for it
+    bool ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb, CConnman& connman);
+
+    /// Add mnb to a batched dseg reply, sending the batch once it is full
+    void AddToMnbBatch(CNode* pnode, std::vector<CMasternodeBroadcast>& vecMnb, const CMasternodeBroadcast& mnb, CConnman& connman);
+    /// Send the rest of a full dseg reply followed by the number of masternodes in it
+    void FinishDsegReply(CNode* pnode, const std::vector<CMasternodeBroadcast>& vecMnb, int nCount, bool fBatch, CConnman& connman);
+
 public:
+    /// Read an mnbbatch message, returns false without reading the entries if it has too many of them
+    static bool ReadMnbBatch(CDataStream& vRecv, std::vector<CMasternodeBroadcast>& vecMnb);
+
     // Keep track of all broadcasts I've seen
     std::map<uint256, std::pair<int64_t, CMasternodeBroadcast> > mapSeenMasternodeBroadcast;
     // Keep track of all pings I've seen
@@ -132,6 +187,21 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if(ser_action.ForRead()) {
+            RebuildPayees();
+            InvalidateSnapshots();
+            {
+                LOCK(cs_collaterals);
+                mapCollaterals.clear();
+            }
+            for (const auto& mnpair : mapMasternodesMnRel) {
+                WatchCollateral(mnpair.first);
+            }
+            mapSeenMasternodePingBySigTime.clear();
+            for (const auto& pair : mapSeenMasternodePing) {
+                mapSeenMasternodePingBySigTime.insert(std::make_pair(pair.second.sigTime, pair.first));
+            }
+        }
         if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
             Clear();
         }
@@ -141,6 +211,13 @@ public:
 
     /// Add an entry
     bool Add(CMasternode &mn);
+    /// Remove an entry along with everything kept for it
+    void Remove(const COutPoint& outpoint);
+    void Remove(const CPubKey& pubKey);
+
+    /// Remember a ping/verification we've seen, returns false if we already knew it
+    bool AddSeenPing(const CMasternodePing& mnp);
+    bool AddSeenVerification(const CMasternodeVerification& mnv);
 
     /// Ask (source) node for mnb
     void AskForMN(CNode *pnode, const COutPoint& outpoint, CConnman& connman);
@@ -175,7 +252,8 @@ public:
     /// Count Masternodes by network type - NET_IPV4, NET_IPV6, NET_TOR
     // int CountByIP(int nNetworkType);
 
-    void DsegUpdate(CNode* pnode, CConnman& connman);
+    /// Ask pnode for its masternode list, returns false if we asked it recently already
+    bool DsegUpdate(CNode* pnode, CConnman& connman);
 
     /// Versions of Find that are safe to use from outside the class
     bool Get(const COutPoint& outpoint, CMasternode& masternodeRet);
@@ -199,8 +277,9 @@ public:
     /// Find a random entry
     masternode_info_t FindRandomNotInVec(const std::vector<COutPoint> &vecToExclude, int nProtocolVersion = -1);
 
-    std::map<COutPoint, CMasternode> GetFullMasternodeMapMnRel() { return mapMasternodesMnRel; }
-    std::map<CPubKey, CMasternode> GetFullMasternodeMap() { return mapMasternodes; }
+    /// Immutable snapshot of the whole list, readers can keep it as long as they need without holding cs
+    snapshot_mnrel_t GetFullMasternodeMapMnRel();
+    snapshot_t GetFullMasternodeMap();
 
     bool GetMasternodeRanks(rank_pair_vec_t& vecMasternodeRanksRet, int nBlockHeight = -1, int nMinProtocol = 0);
     bool GetMasternodeRank(const COutPoint &outpoint, int& nRankRet, int nBlockHeight = -1, int nMinProtocol = 0);
@@ -243,6 +322,12 @@ public:
     void SetMasternodeLastPing(const CPubKey& pubKey, const CMasternodePing& mnp);
 
     void UpdatedBlockTip(const CBlockIndex *pindex);
+    int GetCachedBlockHeight() { return nCachedBlockHeight; }
+
+    /// Mark watched collaterals spent/unspent by a block connected to/disconnected from the active chain
+    void ConnectBlock(const CBlock& block);
+    void DisconnectBlock(const CBlock& block);
+    bool IsCollateralSpent(const COutPoint& outpoint);
 
     /**
      * Called to notify that the masternode index has been updated.
@@ -11,6 +11,7 @@
 #include "net.h"
 
 #include "addrman.h"
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "clientversion.h"
 #include "consensus/consensus.h"
@@ -81,7 +82,7 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 std::string strSubVersion;
 
-std::map<CInv, CDataStream> mapRelay;
+std::map<CInv, CSharedMessage> mapRelay;
 std::deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -425,6 +426,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         }
 
         GetNodeSignals().InitializeNode(pnode, *this);
+        InitRelayInvCursors(pnode);
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
 
@@ -681,10 +683,21 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     nRecvBytes += nBytes;
     while (nBytes > 0) {
 
-        // get current incomplete message, or create a new one
+        // get current incomplete message, or reuse or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+        {
+            bool fReused = false;
+            {
+                LOCK(cs_vProcessMsg);
+                if (!vRecvMsgPool.empty()) {
+                    vRecvMsg.splice(vRecvMsg.end(), vRecvMsgPool, vRecvMsgPool.begin());
+                    fReused = true;
+                }
+            }
+            if (!fReused)
+                vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -724,6 +737,40 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+void CNode::RecycleRecvMsgs(std::list<CNetMessage>& msgs)
+{
+    std::list<CNetMessage>::iterator it = msgs.begin();
+    while (it != msgs.end()) {
+        // Nothing but oversized messages grows past a block, don't pin their memory
+        if (it->vRecv.capacity() > MAX_POOLED_LARGE_RECV_BUFFER) {
+            it = msgs.erase(it);
+            continue;
+        }
+        it->Reset(INIT_PROTO_VERSION);
+        ++it;
+    }
+
+    LOCK(cs_vProcessMsg);
+    // Keep a block-sized buffer for the next block, but only a bounded number of them
+    size_t nLarge = 0;
+    BOOST_FOREACH(const CNetMessage& msg, vRecvMsgPool) {
+        if (msg.vRecv.capacity() > MAX_POOLED_RECV_BUFFER)
+            nLarge++;
+    }
+    it = msgs.begin();
+    while (it != msgs.end() && vRecvMsgPool.size() < RECV_MSG_POOL_SIZE) {
+        std::list<CNetMessage>::iterator itNext = it;
+        ++itNext;
+        bool fLarge = it->vRecv.capacity() > MAX_POOLED_RECV_BUFFER;
+        if (!fLarge || nLarge < MAX_POOLED_LARGE_RECV_BUFFERS) {
+            if (fLarge)
+                nLarge++;
+            vRecvMsgPool.splice(vRecvMsgPool.end(), msgs, it);
+        }
+        it = itNext;
+    }
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -751,6 +798,18 @@ int CNode::GetSendVersion() const
 }
 
 
+void CNetMessage::Reset(int nVersionIn)
+{
+    in_data = false;
+    hdrbuf.clear();
+    hdrbuf.resize(24);
+    nHdrPos = 0;
+    vRecv.clear();
+    nDataPos = 0;
+    nTime = 0;
+    SetVersion(nVersionIn);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -788,8 +847,12 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        // Allocate up to 256 KiB ahead, or double the buffer for large messages,
+        // but never more than the total message size. Reserve first so the
+        // capacity is exactly that and a block fits a pooled buffer.
+        size_t nNewSize = std::min<size_t>(hdr.nMessageSize, std::max<size_t>(nDataPos + nCopy + 256 * 1024, 2 * vRecv.size()));
+        vRecv.reserve(nNewSize);
+        vRecv.resize(nNewSize);
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
@@ -809,11 +872,11 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSharedMessage>::iterator it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -1099,6 +1162,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
+    InitRelayInvCursors(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -1946,6 +2010,7 @@ void CConnman::ThreadMessageHandler()
                 return;
         }
 
+        TrimRelayInv(vNodesCopy);
         ReleaseNodeVector(vNodesCopy);
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
@@ -2137,6 +2202,7 @@ CConnman::CConnman()
     setBannedIsDirty = false;
     fAddressesInitialized = false;
     nLastNodeId = 0;
+    nNextInvSendInbound = 0;
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     semOutbound = NULL;
@@ -2493,39 +2559,168 @@ void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss)
     uint256 hash = tx.GetHash();
     int nInv = (instantsend.HasTxLockRequest(hash) ? MSG_TXLOCK_REQUEST : MSG_TX);
     CInv inv(nInv, hash);
+
+    // Save original serialized message so newer versions are preserved
+    CDataStream msg(BeginMessage(nullptr, PROTOCOL_VERSION, 0, inv.GetCommand()));
+    msg += ss;
+    EndMessage(msg);
+    AddToRelayMemory(inv, FinalizeMessage(msg));
+
+    AppendRelayInv(inv, MIN_PEER_PROTO_VERSION, std::make_shared<const CTransaction>(tx));
+}
+
+void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
+    AppendRelayInv(inv, minProtoVersion, nullptr);
+}
+
+void CConnman::RelayInv(CInv &inv, const CSharedMessage& msg, const int minProtoVersion) {
+    AddToRelayMemory(inv, msg);
+    AppendRelayInv(inv, minProtoVersion, nullptr);
+}
+
+void CConnman::AddToRelayMemory(const CInv& inv, const CSharedMessage& msg)
+{
+    LOCK(cs_mapRelay);
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
     {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    mapRelay.insert(std::make_pair(inv, msg));
+    vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+void CConnman::AppendRelayInv(const CInv& inv, int nMinProtoVersion, const std::shared_ptr<const CTransaction>& ptx)
+{
+    // trickle out tx inv to protect privacy, 1/4 of tx invs blast to all immediately
+    int nQueue = RELAY_INV_IMMEDIATE;
+    if (inv.type == MSG_TX) {
+        static const uint256 hashSalt = GetRandHash();
+        uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
+        hashRand = Hash(BEGIN(hashRand), END(hashRand));
+        if ((UintToArith256(hashRand) & 3) != 0)
+            nQueue = RELAY_INV_TRICKLE;
     }
-    LOCK(cs_vNodes);
-    BOOST_FOREACH(CNode* pnode, vNodes)
+
+    CRelayInvLog& log = relayInvLog[nQueue];
+    LOCK(log.cs);
+    log.vEntries.push_back(CRelayInvLog::Entry{inv, nMinProtoVersion, ptx});
+    if (log.vEntries.size() > MAX_RELAY_INV_LOG_SIZE)
+        log.Trim(log.nBegin);
+    LogPrint("net", "%s -- inv: %s queue=%d seq=%d\n", __func__, inv.ToString(), nQueue, log.End() - 1);
+}
+
+void CRelayInvLog::Trim(uint64_t nSeq)
+{
+    AssertLockHeld(cs);
+    if (End() - std::max(nSeq, nBegin) > MAX_RELAY_INV_LOG_SIZE)
+        nSeq = End() - MAX_RELAY_INV_LOG_SIZE;
+    while (nBegin < nSeq && !vEntries.empty()) {
+        vEntries.pop_front();
+        ++nBegin;
+    }
+    // Every peer is past these ranges
+    while (!mapMessages.empty() && mapMessages.begin()->first.first < nBegin)
+        mapMessages.erase(mapMessages.begin());
+}
+
+void CConnman::InitRelayInvCursors(CNode* pnode)
+{
+    // Only announce what is relayed from now on, like pushing into vInventoryToSend did
+    for (int i = 0; i < 2; i++) {
+        LOCK(relayInvLog[i].cs);
+        pnode->nRelayInvSeq[i] = relayInvLog[i].End();
+    }
+}
+
+void CConnman::TrimRelayInv(const std::vector<CNode*>& vNodesCopy)
+{
+    for (int i = 0; i < 2; i++) {
+        CRelayInvLog& log = relayInvLog[i];
+        LOCK(log.cs);
+        uint64_t nSeq = log.End();
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            nSeq = std::min<uint64_t>(nSeq, pnode->nRelayInvSeq[i]);
+        log.Trim(nSeq);
+    }
+}
+
+void CConnman::PushRelayInventory(CNode* pto, bool fSendTrickle)
+{
+    std::vector<CSharedMessage> vMsgs;
     {
-        if(!pnode->fRelayTxes)
-            continue;
-        LOCK(pnode->cs_filter);
-        if (pnode->pfilter)
-        {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
-                pnode->PushInventory(inv);
-        } else
-            pnode->PushInventory(inv);
+        LOCK(pto->cs_inventory);
+        for (int i = 0; i < (fSendTrickle ? 2 : 1); i++) {
+            CRelayInvLog& log = relayInvLog[i];
+            LOCK(log.cs);
+            uint64_t nBegin = std::max<uint64_t>(pto->nRelayInvSeq[i], log.nBegin);
+            uint64_t nEnd = log.End();
+            pto->nRelayInvSeq[i] = nEnd;
+            if (nBegin >= nEnd)
+                continue;
+
+            std::vector<CInv> vInv;
+            vInv.reserve(std::min<uint64_t>(1000, nEnd - nBegin));
+            bool fFiltered = false;
+            for (uint64_t nSeq = nBegin; nSeq < nEnd; nSeq++) {
+                const CRelayInvLog::Entry& entry = log.vEntries[nSeq - log.nBegin];
+                if (pto->nVersion < entry.nMinProtoVersion) {
+                    fFiltered = true;
+                    continue;
+                }
+                if (entry.ptx) {
+                    LOCK(pto->cs_filter);
+                    if (!pto->fRelayTxes || (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*entry.ptx))) {
+                        fFiltered = true;
+                        continue;
+                    }
+                }
+                if (entry.inv.type == MSG_TX && pto->filterInventoryKnown.contains(entry.inv.hash)) {
+                    fFiltered = true;
+                    continue;
+                }
+                pto->filterInventoryKnown.insert(entry.inv.hash);
+                vInv.push_back(entry.inv);
+            }
+            if (vInv.empty())
+                continue;
+
+            // Peers that announce the whole range share one serialized message
+            if (!fFiltered && vInv.size() <= 1000) {
+                CSharedMessage& pmsg = log.mapMessages[std::make_pair(nBegin, nEnd)];
+                if (!pmsg) {
+                    CDataStream msg(BeginMessage(pto, 0, 0, NetMsgType::INV));
+                    msg << vInv;
+                    EndMessage(msg);
+                    pmsg = FinalizeMessage(msg);
+                }
+                vMsgs.push_back(pmsg);
+                continue;
+            }
+            for (size_t nPos = 0; nPos < vInv.size(); nPos += 1000) {
+                std::vector<CInv> vChunk(vInv.begin() + nPos, vInv.begin() + std::min<size_t>(nPos + 1000, vInv.size()));
+                CDataStream msg(BeginMessage(pto, 0, 0, NetMsgType::INV));
+                msg << vChunk;
+                EndMessage(msg);
+                vMsgs.push_back(FinalizeMessage(msg));
+            }
+        }
     }
+    BOOST_FOREACH(const CSharedMessage& pmsg, vMsgs)
+        PushSharedMessage(pto, pmsg, NetMsgType::INV);
 }
 
-void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
-    LOCK(cs_vNodes);
-    BOOST_FOREACH(CNode* pnode, vNodes)
-        if(pnode->nVersion >= minProtoVersion)
-            pnode->PushInventory(inv);
+int64_t CConnman::PoissonNextSendInbound(int64_t nNow, int average_interval_seconds)
+{
+    int64_t nNext = nNextInvSendInbound;
+    while (nNext < nNow) {
+        int64_t nNew = PoissonNextSend(nNow, average_interval_seconds);
+        if (nNextInvSendInbound.compare_exchange_weak(nNext, nNew))
+            return nNew;
+    }
+    return nNext;
 }
 
 void CConnman::RecordBytesRecv(uint64_t bytes)
@@ -2827,12 +3022,25 @@ void CConnman::EndMessage(CDataStream& strm)
 
 }
 
+CSharedMessage CConnman::FinalizeMessage(CDataStream& strm)
+{
+    std::shared_ptr<CSerializeData> pdata = std::make_shared<CSerializeData>();
+    strm.GetAndClear(*pdata);
+    return pdata;
+}
+
 void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& sCommand)
 {
     if(strm.empty())
         return;
 
-    unsigned int nSize = strm.size() - CMessageHeader::HEADER_SIZE;
+    PushSharedMessage(pnode, FinalizeMessage(strm), sCommand);
+}
+
+void CConnman::PushSharedMessage(CNode* pnode, const CSharedMessage& msg, const std::string& sCommand)
+{
+    assert(msg->size() >= CMessageHeader::HEADER_SIZE);
+    unsigned int nSize = msg->size() - CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(sCommand.c_str()), nSize, pnode->id);
 
     size_t nBytesSent = 0;
@@ -2842,11 +3050,11 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
             return;
         }
         bool optimisticSend(pnode->vSendMsg.empty());
-        pnode->vSendMsg.emplace_back(strm.begin(), strm.end());
+        pnode->vSendMsg.push_back(msg);
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[sCommand] += strm.size();
-        pnode->nSendSize += strm.size();
+        pnode->mapSendBytesPerMsgCmd[sCommand] += msg->size();
+        pnode->nSendSize += msg->size();
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
@@ -10,6 +10,7 @@
 #include "addrman.h"
 #include "bloom.h"
 #include "compat.h"
+#include "consensus/consensus.h"
 #include "limitedmap.h"
 #include "netaddress.h"
 #include "protocol.h"
@@ -75,6 +76,15 @@ static const bool DEFAULT_UPNP = false;
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency)*/
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
+/** Number of processed messages each peer keeps to receive the next ones into */
+static const size_t RECV_MSG_POOL_SIZE = 4;
+/** Receive buffers up to this size are kept for reuse */
+static const size_t MAX_POOLED_RECV_BUFFER = 256 * 1024;
+/** Larger ones, up to a full block, are only kept this many at a time per peer */
+static const size_t MAX_POOLED_LARGE_RECV_BUFFERS = 1;
+static const size_t MAX_POOLED_LARGE_RECV_BUFFER = MAX_LEGACY_BLOCK_SIZE;
+/** Relayed inventory kept for peers to announce, even when one falls behind */
+static const size_t MAX_RELAY_INV_LOG_SIZE = 100000;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 /** The default for -maxuploadtarget. 0 = Unlimited */
@@ -105,6 +115,43 @@ class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A complete wire message (header, checksum and payload) that is never
+ * modified once built, so the same bytes can sit in many nodes' vSendMsg.
+ */
+typedef std::shared_ptr<const CSerializeData> CSharedMessage;
+
+/**
+ * Append-only log of inventory relayed to all peers. Relaying appends an
+ * item once instead of pushing it into every node's vInventoryToSend; each
+ * node keeps a cursor into the log and announces what it has not seen yet
+ * when it sends inventory. INV messages covering a range of the log are
+ * serialized once and shared by all peers that announce that range in full.
+ */
+struct CRelayInvLog
+{
+    struct Entry
+    {
+        CInv inv;
+        int nMinProtoVersion;
+        //! The transaction itself, for peers with a bloom filter
+        std::shared_ptr<const CTransaction> ptx;
+    };
+
+    mutable CCriticalSection cs;
+    //! Entry i has sequence number nBegin + i
+    std::deque<Entry> vEntries;
+    uint64_t nBegin;
+    //! Serialized INV messages by [begin, end) range of the log
+    std::map<std::pair<uint64_t, uint64_t>, CSharedMessage> mapMessages;
+
+    CRelayInvLog() : nBegin(0) {}
+
+    uint64_t End() const { return nBegin + vEntries.size(); }
+    //! Forget entries before nSeq, and the oldest ones beyond MAX_RELAY_INV_LOG_SIZE
+    void Trim(uint64_t nSeq);
+};
+
 class CConnman
 {
 public:
@@ -201,6 +248,19 @@ public:
         PushMessageWithVersionAndFlag(pnode, 0, 0, sCommand, std::forward<Args>(args)...);
     }
 
+    /** Serialize a message once, to be pushed to any number of nodes with PushSharedMessage */
+    template <typename... Args>
+    CSharedMessage MakeSharedMessage(int nVersion, const std::string& sCommand, Args&&... args)
+    {
+        assert(nVersion != 0);
+        auto msg(BeginMessage(nullptr, nVersion, 0, sCommand));
+        ::SerializeMany(msg, msg.nType, msg.nVersion, std::forward<Args>(args)...);
+        EndMessage(msg);
+        return FinalizeMessage(msg);
+    }
+
+    void PushSharedMessage(CNode* pnode, const CSharedMessage& msg, const std::string& sCommand);
+
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func)
     {
@@ -307,6 +367,21 @@ public:
     void RelayTransaction(const CTransaction& tx);
     void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
     void RelayInv(CInv &inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+    /**
+     * Relay an inv and keep msg around to answer getdata for it, instead of serializing per request.
+     * Cached messages are served for 15 minutes without asking the owning manager, so only use this
+     * for objects whose serialization can't change in that time (e.g. not with SPORK_14 dependent fields).
+     */
+    void RelayInv(CInv &inv, const CSharedMessage& msg, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+
+    enum RelayInvQueue {
+        RELAY_INV_IMMEDIATE = 0, //! sent on the next pass
+        RELAY_INV_TRICKLE = 1,   //! sent when the peer's trickle timer fires
+    };
+    /** Announce relayed inventory the node has not been offered yet; the trickled part only if fSendTrickle */
+    void PushRelayInventory(CNode* pto, bool fSendTrickle);
+    /** Next time to trickle inventory to inbound peers, shared so they all get the same batch */
+    int64_t PoissonNextSendInbound(int64_t nNow, int average_interval_seconds);
 
     // Addrman functions
     size_t GetAddressCount() const;
@@ -432,6 +507,12 @@ private:
     CDataStream BeginMessage(CNode* node, int nVersion, int flags, const std::string& sCommand);
     void PushMessage(CNode* pnode, CDataStream& strm, const std::string& sCommand);
     void EndMessage(CDataStream& strm);
+    CSharedMessage FinalizeMessage(CDataStream& strm);
+    void AddToRelayMemory(const CInv& inv, const CSharedMessage& msg);
+
+    void AppendRelayInv(const CInv& inv, int nMinProtoVersion, const std::shared_ptr<const CTransaction>& ptx);
+    void InitRelayInvCursors(CNode* pnode);
+    void TrimRelayInv(const std::vector<CNode*>& vNodesCopy);
 
     // Network stats
     void RecordBytesRecv(uint64_t bytes);
@@ -499,6 +580,9 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    CRelayInvLog relayInvLog[2];
+    std::atomic<int64_t> nNextInvSendInbound;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
@@ -571,7 +655,7 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSharedMessage> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
@@ -652,6 +736,9 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    //! Make the message ready to receive again, keeping its buffers' capacity
+    void Reset(int nVersionIn);
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -669,11 +756,13 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSharedMessage> vSendMsg;
     CCriticalSection cs_vSend;
 
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
+    //! Processed messages waiting to be received into again, guarded by cs_vProcessMsg
+    std::list<CNetMessage> vRecvMsgPool;
     size_t nProcessQueueSize;
 
     std::deque<CInv> vRecvGetData;
@@ -740,6 +829,8 @@ public:
     CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    //! Position in CConnman's relayed inventory logs up to which this node has been offered everything
+    std::atomic<uint64_t> nRelayInvSeq[2];
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
     int64_t nNextInvSend;
@@ -807,6 +898,8 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    //! Hand processed messages back so their list nodes and buffers are reused
+    void RecycleRecvMsgs(std::list<CNetMessage>& msgs);
 
     void SetRecvVersion(int nVersionIn)
     {
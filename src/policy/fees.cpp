@@ -12,42 +12,45 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
-                                unsigned int maxConfirms, double _decay, std::string _dataTypeString)
+                                unsigned int _maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
-    for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
-        buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
-    }
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
-    }
+    buckets = defaultBuckets;
+    maxConfirms = _maxConfirms;
+    ResizeArrays();
+}
+
+void TxConfirmStats::ResizeArrays()
+{
+    decayScale = 1;
+    confAvg.assign(maxConfirms * buckets.size(), 0);
+    unconfTxs.assign(maxConfirms * buckets.size(), 0);
+    oldUnconfTxs.assign(buckets.size(), 0);
+    txCtAvg.assign(buckets.size(), 0);
+    avg.assign(buckets.size(), 0);
+}
 
-    oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
-    txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-    avg.resize(buckets.size());
+unsigned int TxConfirmStats::FindBucketIndex(double val) const
+{
+    std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    if (it == buckets.end())
+        return buckets.size() - 1;
+    return it - buckets.begin();
 }
 
-// Zero out the data for the current block
+// Roll over the mempool ring entry and decay everything by one block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
+    int* unconfRow = &unconfTxs[(nBlockHeight % maxConfirms) * buckets.size()];
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
+        oldUnconfTxs[j] += unconfRow[j];
+        unconfRow[j] = 0;
     }
+    decayScale /= decay;
 }
 
 
@@ -56,22 +59,32 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
+    unsigned int bucketindex = FindBucketIndex(val);
+    for (size_t i = blocksToConfirm; i <= maxConfirms; i++) {
+        confAvg[(i - 1) * buckets.size() + bucketindex] += decayScale;
     }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
+    txCtAvg[bucketindex] += decayScale;
+    avg[bucketindex] += val * decayScale;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
+    if (decayScale > DECAY_RESCALE_THRESHOLD)
+        Rescale();
+}
+
+void TxConfirmStats::Rescale()
+{
+    if (decayScale == 1)
+        return;
+    double invScale = 1 / decayScale;
+    for (unsigned int i = 0; i < confAvg.size(); i++)
+        confAvg[i] *= invScale;
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+        avg[j] *= invScale;
+        txCtAvg[j] *= invScale;
     }
+    decayScale = 1;
 }
 
 // returns -1 on error conditions
@@ -104,15 +117,17 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = maxConfirms;
+    double invScale = 1 / decayScale;
+    const double* confRow = &confAvg[(confTarget - 1) * buckets.size()];
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        nConf += confRow[bucket] * invScale;
+        totalNum += txCtAvg[bucket] * invScale;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+            extraNum += unconfTxs[((nBlockHeight - confct)%bins) * buckets.size() + bucket];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -158,7 +173,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
             if (txCtAvg[j] < txSum)
                 txSum -= txCtAvg[j];
-            else { // we're in the right bucket
+            else { // we're in the right bucket (both are scaled alike, so the ratio is exact)
                 median = avg[j] / txCtAvg[j];
                 break;
             }
@@ -175,22 +190,25 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // Store the true averages so the file does not depend on the current decay epoch
+    Rescale();
     fileout << decay;
     fileout << buckets;
+    fileout << maxConfirms;
     fileout << avg;
     fileout << txCtAvg;
     fileout << confAvg;
 }
 
-void TxConfirmStats::Read(CAutoFile& filein)
+void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion)
 {
     // Read data file into temporary variables and do some very basic sanity checking
     std::vector<double> fileBuckets;
     std::vector<double> fileAvg;
-    std::vector<std::vector<double> > fileConfAvg;
+    std::vector<double> fileConfAvg;
     std::vector<double> fileTxCtAvg;
     double fileDecay;
-    size_t maxConfirms;
+    unsigned int fileMaxConfirms = 0;
     size_t numBuckets;
 
     filein >> fileDecay;
@@ -200,46 +218,45 @@ void TxConfirmStats::Read(CAutoFile& filein)
     numBuckets = fileBuckets.size();
     if (numBuckets <= 1 || numBuckets > 1000)
         throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 fee/pri buckets");
+    if (!std::is_sorted(fileBuckets.begin(), fileBuckets.end()))
+        throw std::runtime_error("Corrupt estimates file. Fee/pri buckets must be in ascending order");
+    if (nFileVersion >= FEE_ESTIMATES_FLAT_VERSION)
+        filein >> fileMaxConfirms;
     filein >> fileAvg;
     if (fileAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri average bucket count");
     filein >> fileTxCtAvg;
     if (fileTxCtAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
-    filein >> fileConfAvg;
-    maxConfirms = fileConfAvg.size();
-    if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) // one week
-        throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        if (fileConfAvg[i].size() != numBuckets)
+    if (nFileVersion >= FEE_ESTIMATES_FLAT_VERSION) {
+        filein >> fileConfAvg;
+        if (fileConfAvg.size() != fileMaxConfirms * numBuckets)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
+    } else {
+        // Legacy layout: one vector per confirmation target
+        std::vector<std::vector<double> > fileConfAvgLegacy;
+        filein >> fileConfAvgLegacy;
+        fileMaxConfirms = fileConfAvgLegacy.size();
+        fileConfAvg.reserve(fileMaxConfirms * numBuckets);
+        for (unsigned int i = 0; i < fileConfAvgLegacy.size(); i++) {
+            if (fileConfAvgLegacy[i].size() != numBuckets)
+                throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
+            fileConfAvg.insert(fileConfAvg.end(), fileConfAvgLegacy[i].begin(), fileConfAvgLegacy[i].end());
+        }
     }
+    if (fileMaxConfirms <= 0 || fileMaxConfirms > 6 * 24 * 7) // one week
+        throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
+
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
     decay = fileDecay;
     buckets = fileBuckets;
-    avg = fileAvg;
-    confAvg = fileConfAvg;
-    txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
-
-    // Resize the current block variables which aren't stored in the data file
-    // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        unconfTxs[i].resize(buckets.size());
-    }
-    oldUnconfTxs.resize(buckets.size());
-
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
+    maxConfirms = fileMaxConfirms;
+    // Reset the mempool tracking which isn't stored in the data file
+    ResizeArrays();
+    avg.swap(fileAvg);
+    confAvg.swap(fileConfAvg);
+    txCtAvg.swap(fileTxCtAvg);
 
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
@@ -247,9 +264,9 @@ void TxConfirmStats::Read(CAutoFile& filein)
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int bucketindex = FindBucketIndex(val);
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    unconfTxs[blockIndex * buckets.size() + bucketindex]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
     return bucketindex;
 }
@@ -265,7 +282,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)maxConfirms) {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
         else
@@ -273,9 +290,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
                      bucketindex);
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % maxConfirms;
+        if (unconfTxs[blockIndex * buckets.size() + bucketindex] > 0)
+            unconfTxs[blockIndex * buckets.size() + bucketindex]--;
         else
             LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -570,11 +587,11 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     priStats.Write(fileout);
 }
 
-void CBlockPolicyEstimator::Read(CAutoFile& filein)
+void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
 {
     int nFileBestSeenHeight;
     filein >> nFileBestSeenHeight;
-    feeStats.Read(filein);
-    priStats.Read(filein);
+    feeStats.Read(filein, nFileVersion);
+    priStats.Read(filein, nFileVersion);
     nBestSeenHeight = nFileBestSeenHeight;
 }
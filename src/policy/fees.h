@@ -80,27 +80,28 @@ class TxConfirmStats
 {
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
-    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive), ascending
+    unsigned int maxConfirms;                 // Number of confirmation targets Y tracked per bucket
+
+    // All moving averages below are stored lazily decayed: the true value is the stored value
+    // divided by decayScale.  Starting a new block only multiplies decayScale by 1/decay instead
+    // of touching every bucket, and new data points are added pre-multiplied by decayScale.
+    // Once decayScale grows past DECAY_RESCALE_THRESHOLD the stored values are folded back
+    // and a new decay epoch begins with decayScale = 1.
+    double decayScale;
 
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
+    std::vector<double> confAvg; // confAvg[(Y-1)*buckets.size() + X]
 
     // Sum the total priority/fee of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
@@ -111,11 +112,19 @@ private:
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[(Y%maxConfirms)*buckets.size() + X]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Resize all per-bucket arrays to match buckets and maxConfirms, zeroing them */
+    void ResizeArrays();
+
+    /** Fold decayScale into the stored averages and start a new decay epoch */
+    void Rescale();
+
 public:
+    TxConfirmStats() : maxConfirms(0), decayScale(1), decay(0) {}
+
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
      * constructor with default values.
@@ -126,7 +135,13 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
+    /** Return the index of the bucket val falls into (binary search over the bucket bounds) */
+    unsigned int FindBucketIndex(double val) const;
+
+    /**
+     * Start counting for a new block: roll the mempool ring entry for nBlockHeight into
+     * oldUnconfTxs and advance the lazy decay by one block
+     */
     void ClearCurrent(unsigned int nBlockHeight);
 
     /**
@@ -144,8 +159,8 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
+    /** Finish the current block.  Decay is applied lazily, so this only starts a new
+        decay epoch when the accumulated scale factor has grown too large */
     void UpdateMovingAverages();
 
     /**
@@ -163,7 +178,7 @@ public:
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() { return maxConfirms; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
@@ -171,8 +186,9 @@ public:
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
      * variables with this state.
+     * @param nFileVersion the version required to read the file, selects the legacy or flat layout
      */
-    void Read(CAutoFile& filein);
+    void Read(CAutoFile& filein, int nFileVersion);
 };
 
 
@@ -183,6 +199,18 @@ static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 /** Decay of .998 is a half-life of 346 blocks or about 14.4 hours */
 static const double DEFAULT_DECAY = .998;
 
+/** Start a new lazy decay epoch once the scale factor exceeds this (~6900 blocks at DEFAULT_DECAY) */
+static const double DECAY_RESCALE_THRESHOLD = 1e6;
+
+/**
+ * Written as the version required to read fee_estimates.dat when the
+ * confirmation averages are stored as flat arrays. It is above every client
+ * version, so releases that only know the nested layout (which require
+ * 0.12.00, 120000) refuse the file instead of misparsing it. Readers that
+ * know the flat layout accept this marker explicitly.
+ */
+static const int FEE_ESTIMATES_FLAT_VERSION = 99000000;
+
 /** Require greater than 95% of X fee transactions to be confirmed within Y blocks for X to be big enough */
 static const double MIN_SUCCESS_PCT = .95;
 static const double UNLIKELY_PCT = .5;
@@ -261,8 +289,8 @@ public:
     /** Write estimation data to a file */
     void Write(CAutoFile& fileout);
 
-    /** Read estimation data from a file */
-    void Read(CAutoFile& filein);
+    /** Read estimation data from a file written by a client requiring nFileVersion */
+    void Read(CAutoFile& filein, int nFileVersion);
 
 private:
     CFeeRate minTrackedFee; //! Passed to constructor to avoid dependency on main
@@ -35,6 +35,10 @@ const char *FILTERADD="filteradd";
 const char *FILTERCLEAR="filterclear";
 const char *REJECT="reject";
 const char *SENDHEADERS="sendheaders";
+const char *SENDCMPCT="sendcmpct";
+const char *CMPCTBLOCK="cmpctblock";
+const char *GETBLOCKTXN="getblocktxn";
+const char *BLOCKTXN="blocktxn";
 // FuturoCoin message types
 const char *TXLOCKREQUEST="ix";
 const char *TXLOCKVOTE="txlvote";
@@ -50,6 +54,7 @@ const char *MNBUDGETFINAL="fbs"; // depreciated since 12.1
 const char *MNBUDGETFINALVOTE="fbvote"; // depreciated since 12.1
 const char *MNQUORUM="mn quorum"; // not implemented
 const char *MNANNOUNCE="mnb";
+const char *MNANNOUNCEBATCH="mnbbatch";
 const char *MNPING="mnp";
 const char *DSACCEPT="dsa";
 const char *DSVIN="dsi";
@@ -85,6 +90,7 @@ static const char* ppszTypeName[] =
     NetMsgType::DSTX,
     NetMsgType::MNVERIFY,
     NetMsgType::MNLISTUPDATE,
+    NetMsgType::CMPCTBLOCK,
 };
 
 /** All known message types. Keep this in the same order as the list of
@@ -113,6 +119,10 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::FILTERCLEAR,
     NetMsgType::REJECT,
     NetMsgType::SENDHEADERS,
+    NetMsgType::SENDCMPCT,
+    NetMsgType::CMPCTBLOCK,
+    NetMsgType::GETBLOCKTXN,
+    NetMsgType::BLOCKTXN,
     // FuturoCoin message types
     // NOTE: do NOT include non-implmented here, we want them to be "Unknown command" in ProcessMessage()
     NetMsgType::TXLOCKREQUEST,
@@ -123,6 +133,7 @@ const static std::string allNetMessageTypes[] = {
     // NetMsgType::MASTERNODEPAYMENTBLOCK, // there is no message for this, only inventory
     NetMsgType::MASTERNODEPAYMENTSYNC,
     NetMsgType::MNANNOUNCE,
+    NetMsgType::MNANNOUNCEBATCH,
     NetMsgType::MNPING,
     NetMsgType::DSACCEPT,
     NetMsgType::DSVIN,
@@ -24,6 +24,8 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_REST_BLOCKS_COUNT = 100; //allow a max of 100 raw blocks to be fetched at once
+static const size_t REST_JSON_FLUSH_SIZE = 64 * 1024; //hand streamed JSON to the reply buffer in chunks of this size
 
 enum RetFormat {
     RF_UNDEF,
@@ -59,12 +61,84 @@ struct CCoin {
 };
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
-extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
+/**
+ * Writes compact JSON straight into the reply body of a request, producing
+ * the same output as UniValue::write() without first building the whole
+ * document as a UniValue tree.
+ */
+class CJSONStreamWriter
+{
+private:
+    HTTPRequest* req;
+    std::string strBuffer;
+    std::vector<bool> vNeedComma; // one entry per open object/array
+    bool fAfterKey;
+
+    void Separator()
+    {
+        if (fAfterKey) {
+            fAfterKey = false;
+            return;
+        }
+        if (!vNeedComma.empty()) {
+            if (vNeedComma.back())
+                strBuffer += ',';
+            vNeedComma.back() = true;
+        }
+    }
+
+    void MaybeFlush()
+    {
+        if (strBuffer.size() >= REST_JSON_FLUSH_SIZE)
+            Flush();
+    }
+
+public:
+    CJSONStreamWriter(HTTPRequest* reqIn) : req(reqIn), fAfterKey(false)
+    {
+        strBuffer.reserve(REST_JSON_FLUSH_SIZE + 1024);
+    }
+
+    void BeginObject() { Separator(); strBuffer += '{'; vNeedComma.push_back(false); }
+    void EndObject() { strBuffer += '}'; vNeedComma.pop_back(); MaybeFlush(); }
+    void BeginArray() { Separator(); strBuffer += '['; vNeedComma.push_back(false); }
+    void EndArray() { strBuffer += ']'; vNeedComma.pop_back(); MaybeFlush(); }
+
+    void Key(const std::string& strKey)
+    {
+        Separator();
+        strBuffer += UniValue(strKey).write();
+        strBuffer += ':';
+        fAfterKey = true;
+    }
+
+    void Value(const UniValue& val)
+    {
+        Separator();
+        strBuffer += val.write();
+        MaybeFlush();
+    }
+
+    void Pair(const std::string& strKey, const UniValue& val)
+    {
+        Key(strKey);
+        Value(val);
+    }
+
+    void Flush()
+    {
+        if (strBuffer.empty())
+            return;
+        req->WriteReplyBody(strBuffer.data(), strBuffer.size());
+        strBuffer.clear();
+    }
+};
+
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
     req->WriteHeader("Content-Type", "text/plain");
@@ -200,6 +274,71 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Block index derived fields of the JSON block representation, captured under cs_main. */
+struct CRESTBlockIndexInfo {
+    int nConfirmations;
+    int nHeight;
+    int64_t nMedianTime;
+    double dDifficulty;
+    std::string strChainWork;
+    std::string strPrevHash;
+    std::string strNextHash;
+};
+
+static void GetBlockIndexInfo(const CBlockIndex* pblockindex, CRESTBlockIndexInfo& info)
+{
+    AssertLockHeld(cs_main);
+    info.nConfirmations = -1;
+    // Only report confirmations if the block is on the main chain
+    if (chainActive.Contains(pblockindex))
+        info.nConfirmations = chainActive.Height() - pblockindex->nHeight + 1;
+    info.nHeight = pblockindex->nHeight;
+    info.nMedianTime = pblockindex->GetMedianTimePast();
+    info.dDifficulty = GetDifficulty(pblockindex);
+    info.strChainWork = pblockindex->nChainWork.GetHex();
+    if (pblockindex->pprev)
+        info.strPrevHash = pblockindex->pprev->GetBlockHash().GetHex();
+    const CBlockIndex* pnext = chainActive.Next(pblockindex);
+    if (pnext)
+        info.strNextHash = pnext->GetBlockHash().GetHex();
+}
+
+/** Stream a block in the same layout as blockToJSON, one transaction at a time. */
+static void StreamBlockJSON(CJSONStreamWriter& writer, const CBlock& block, const CRESTBlockIndexInfo& info, bool txDetails)
+{
+    writer.BeginObject();
+    writer.Pair("hash", block.GetHash().GetHex());
+    writer.Pair("confirmations", info.nConfirmations);
+    writer.Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Pair("height", info.nHeight);
+    writer.Pair("version", block.nVersion);
+    writer.Pair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        if (txDetails) {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            writer.Value(objTx);
+        } else {
+            writer.Value(tx.GetHash().GetHex());
+        }
+    }
+    writer.EndArray();
+    writer.Pair("time", block.GetBlockTime());
+    writer.Pair("mediantime", info.nMedianTime);
+    writer.Pair("nonce", (uint64_t)block.nNonce);
+    writer.Pair("bits", strprintf("%08x", block.nBits));
+    writer.Pair("difficulty", info.dDifficulty);
+    writer.Pair("chainwork", info.strChainWork);
+    if (!info.strPrevHash.empty())
+        writer.Pair("previousblockhash", info.strPrevHash);
+    if (!info.strNextHash.empty())
+        writer.Pair("nextblockhash", info.strNextHash);
+    writer.EndObject();
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -215,6 +354,7 @@ static bool rest_block(HTTPRequest* req,
 
     CBlock block;
     CBlockIndex* pblockindex = NULL;
+    CRESTBlockIndexInfo info;
     {
         LOCK(cs_main);
         if (mapBlockIndex.count(hash) == 0)
@@ -226,20 +366,23 @@ static bool rest_block(HTTPRequest* req,
 
         if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
-    }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+        GetBlockIndexInfo(pblockindex, info);
+    }
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
         req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
+        req->WriteReplyBody(&ssBlock[0], ssBlock.size());
+        req->WriteReply(HTTP_OK);
         return true;
     }
 
     case RF_HEX: {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
         string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
@@ -247,10 +390,11 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
+        CJSONStreamWriter writer(req);
+        StreamBlockJSON(writer, block, info, showTxDetails);
+        writer.Flush();
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->WriteReply(HTTP_OK, "\n");
         return true;
     }
 
@@ -273,6 +417,87 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block range specified. Use /rest/blocks/<start>/<count>.<ext>.");
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    int32_t nStart;
+    if (!ParseInt32(path[0], &nStart) || nStart < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + path[0]);
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_BLOCKS_COUNT)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    // Only the block positions are looked up under cs_main, the blocks are
+    // read from disk without holding it. Ranges past the tip are truncated.
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_main);
+        if (nStart > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Start height " + path[0] + " not found");
+
+        int nEnd = std::min((int64_t)chainActive.Height(), (int64_t)nStart + count - 1);
+        vPos.reserve(nEnd - nStart + 1);
+        for (int nHeight = nStart; nHeight <= nEnd; nHeight++) {
+            const CBlockIndex* pindex = chainActive[nHeight];
+            if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, strprintf("Block %d not available (pruned data)", nHeight));
+            vPos.push_back(pindex->GetBlockPos());
+        }
+    }
+
+    // Each block is appended to the reply body as soon as it is read, so only
+    // one of them is held outside the body at a time. Nothing is sent before
+    // WriteReply, so if any block in the range can't be read the partial body
+    // is dropped and the whole request fails.
+    std::vector<unsigned char> vchBlock;
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        if (!ReadRawBlockFromDisk(vchBlock, vPos[i], Params().MessageStart())) {
+            req->ClearReplyBody();
+            return RESTERR(req, HTTP_NOT_FOUND, strprintf("Block %d not found", nStart + i));
+        }
+        if (rf == RF_BINARY) {
+            req->WriteReplyBody((const char*)vchBlock.data(), vchBlock.size());
+        } else {
+            string strHex = HexStr(vchBlock.begin(), vchBlock.end());
+            req->WriteReplyBody(strHex.data(), strHex.size());
+        }
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK);
+        return true;
+    }
+
+    case RF_HEX: {
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, "\n");
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -603,6 +828,7 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
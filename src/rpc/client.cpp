@@ -101,6 +101,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "lockunspent", 1 },
     { "importprivkey", 2 },
     { "importelectrumwallet", 1 },
+    { "rescanblockchain", 0 },
+    { "rescanblockchain", 1 },
     { "importaddress", 2 },
     { "importaddress", 3 },
     { "importpubkey", 2 },
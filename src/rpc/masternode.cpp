@@ -544,9 +544,9 @@ UniValue masternodelist(const UniValue& params, bool fHelp)
     } else {
         if (fMasterNodesReleased) {
             // SPORK_14_MNODES_RELEASE_ENABLED active
-            std::map<COutPoint, CMasternode> mapMasternodes = mnodeman.GetFullMasternodeMapMnRel();
-            for (auto& mnpair : mapMasternodes) {
-                CMasternode mn = mnpair.second;
+            CMasternodeMan::snapshot_mnrel_t mapMasternodes = mnodeman.GetFullMasternodeMapMnRel();
+            for (const auto& mnpair : *mapMasternodes) {
+                const CMasternode& mn = mnpair.second;
                 std::string strOutpoint = mnpair.first.ToStringShort();
                 if (strMode == "activeseconds") {
                     if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
@@ -614,9 +614,9 @@ UniValue masternodelist(const UniValue& params, bool fHelp)
                 }
             }
         } else {
-            std::map<CPubKey, CMasternode> mapMasternodes = mnodeman.GetFullMasternodeMap();
-            for (auto& mnpair : mapMasternodes) {
-                CMasternode mn = mnpair.second;
+            CMasternodeMan::snapshot_t mapMasternodes = mnodeman.GetFullMasternodeMap();
+            for (const auto& mnpair : *mapMasternodes) {
+                const CMasternode& mn = mnpair.second;
 
                 std::string strPubKeyMasternode = HexStr(mnpair.first);
 
@@ -22,6 +22,9 @@
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #endif
+#if ENABLE_ZMQ
+#include "zmq/zmqpublishnotifier.h"
+#endif
 
 #include <stdint.h>
 
@@ -69,6 +72,10 @@ UniValue getinfo(const UniValue& params, bool fHelp)
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee set in " + CURRENCY_UNIT + "/kB\n"
             "  \"relayfee\": x.xxxx,         (numeric) minimum relay fee for non-free transactions in " + CURRENCY_UNIT + "/kB\n"
             "  \"errors\": \"...\"           (string) any error messages\n"
+            "  \"cacheloadtimes\": {          (json object) milliseconds each masternode cache file took to load at startup\n"
+            "     \"file\": xxxx,              (numeric) load time of the named file\n"
+            "     ...\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getinfo", "")
@@ -111,6 +118,12 @@ UniValue getinfo(const UniValue& params, bool fHelp)
 #endif
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
     obj.push_back(Pair("errors",        GetWarnings("statusbar")));
+
+    UniValue cacheLoadTimes(UniValue::VOBJ);
+    std::map<std::string, int64_t> mapCacheLoadTimes = GetCacheLoadTimes();
+    for (std::map<std::string, int64_t>::const_iterator it = mapCacheLoadTimes.begin(); it != mapCacheLoadTimes.end(); ++it)
+        cacheLoadTimes.push_back(Pair(it->first, it->second));
+    obj.push_back(Pair("cacheloadtimes", cacheLoadTimes));
     return obj;
 }
 
@@ -159,6 +172,7 @@ UniValue mnsync(const UniValue& params, bool fHelp)
         objStatus.push_back(Pair("IsWinnersListSynced", masternodeSync.IsWinnersListSynced()));
         objStatus.push_back(Pair("IsSynced", masternodeSync.IsSynced()));
         objStatus.push_back(Pair("IsFailed", masternodeSync.IsFailed()));
+        objStatus.push_back(Pair("AssetStats", masternodeSync.GetAssetStats()));
         return objStatus;
     }
 
@@ -177,6 +191,37 @@ UniValue mnsync(const UniValue& params, bool fHelp)
     return "failure";
 }
 
+#if ENABLE_ZMQ
+UniValue getzmqnotifications(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getzmqnotifications\n"
+            "Returns the counters of the thread publishing ZMQ notifications.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": xxxxx,     (numeric) notifications accepted into the send queue\n"
+            "  \"sent\": xxxxx,       (numeric) notifications published\n"
+            "  \"dropped\": xxxxx,    (numeric) notifications dropped because the send queue was full\n"
+            "  \"failed\": xxxxx,     (numeric) notifications that could not be read or sent\n"
+            "  \"queuesize\": xxxxx   (numeric) notifications currently waiting to be published\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getzmqnotifications", "")
+            + HelpExampleRpc("getzmqnotifications", "")
+        );
+
+    CZMQSenderStats stats = GetZMQSenderStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("queued", stats.nQueued));
+    obj.push_back(Pair("sent", stats.nSent));
+    obj.push_back(Pair("dropped", stats.nDropped));
+    obj.push_back(Pair("failed", stats.nFailed));
+    obj.push_back(Pair("queuesize", (uint64_t)stats.nQueueSize));
+    return obj;
+}
+#endif
+
 #ifdef ENABLE_WALLET
 class DescribeAddressVisitor : public boost::static_visitor<UniValue>
 {
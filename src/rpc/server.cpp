@@ -259,6 +259,9 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
     { "control",            "debug",                  &debug,                  true  },
+#if ENABLE_ZMQ
+    { "control",            "getzmqnotifications",    &getzmqnotifications,    true  },
+#endif
     { "control",            "help",                   &help,                   true  },
     { "control",            "stop",                   &stop,                   true  },
 
@@ -377,6 +380,8 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "importelectrumwallet",   &importelectrumwallet,   true  },
     { "wallet",             "importaddress",          &importaddress,          true  },
     { "wallet",             "importpubkey",           &importpubkey,           true  },
+    { "wallet",             "rescanblockchain",       &rescanblockchain,       true  },
+    { "wallet",             "abortrescan",            &abortrescan,            true  },
     { "wallet",             "keypoolrefill",          &keypoolrefill,          true  },
     { "wallet",             "listaccounts",           &listaccounts,           false },
     { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false },
@@ -0,0 +1,142 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+
+#include "key.h"
+#include "masternode-payments.h"
+#include "script/standard.h"
+#include "streams.h"
+
+#include "test/test_futurocoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternode_payments_tests, TestChain100Setup)
+
+// Votes need the block 101 below them to exist, so 101..201 are usable on this chain
+static CMasternodePaymentVote MakeVote(int nBlockHeight, bool fVerified = true)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMasternodePaymentVote vote(key.GetPubKey(), nBlockHeight, GetScriptForDestination(key.GetPubKey().GetID()));
+    if (fVerified)
+        vote.vchSig.push_back(1);
+    return vote;
+}
+
+static std::vector<uint256> GetSyncHashes(CMasternodePayments& mnpayments, int nHeight)
+{
+    std::vector<uint256> vecHashes;
+    mnpayments.GetVoteHashesToSync(nHeight, vecHashes);
+    std::sort(vecHashes.begin(), vecHashes.end());
+    return vecHashes;
+}
+
+BOOST_AUTO_TEST_CASE(vote_store)
+{
+    CMasternodePayments mnpayments;
+    CMasternodePaymentVote vote1 = MakeVote(150);
+    CMasternodePaymentVote vote2 = MakeVote(150);
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote1));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote2));
+    BOOST_CHECK(!mnpayments.AddPaymentVote(vote1));
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 2);
+    BOOST_CHECK_EQUAL(mnpayments.GetBlockCount(), 1);
+
+    // An unverified vote is stored but not announced until it's verified,
+    // and verifying it doesn't index it twice
+    CMasternodePaymentVote vote3 = MakeVote(150, false);
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote3));
+    BOOST_CHECK(!mnpayments.HasVerifiedPaymentVote(vote3.GetHash()));
+    BOOST_CHECK_EQUAL(GetSyncHashes(mnpayments, 150).size(), 2);
+    vote3.vchSig.push_back(1);
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote3));
+    BOOST_CHECK(mnpayments.HasVerifiedPaymentVote(vote3.GetHash()));
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 3);
+    BOOST_CHECK_EQUAL(GetSyncHashes(mnpayments, 150).size(), 3);
+
+    CMasternodePaymentVote voteRet;
+    BOOST_CHECK(mnpayments.GetVerifiedPaymentVote(vote3.GetHash(), voteRet));
+    BOOST_CHECK(voteRet.GetHash() == vote3.GetHash());
+    BOOST_CHECK(!mnpayments.GetVerifiedPaymentVote(MakeVote(150).GetHash(), voteRet));
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 3);
+
+    // No chain below it, not stored
+    BOOST_CHECK(!mnpayments.AddPaymentVote(MakeVote(300)));
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(vote_sync_selection)
+{
+    CMasternodePayments mnpayments;
+    CMasternodePaymentVote vote1 = MakeVote(149);
+    CMasternodePaymentVote vote2 = MakeVote(150);
+    CMasternodePaymentVote vote3 = MakeVote(169);
+    CMasternodePaymentVote vote4 = MakeVote(170);
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote1));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote2));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote3));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote4));
+    BOOST_CHECK(mnpayments.AddPaymentVote(MakeVote(160, false)));
+
+    // Only verified votes for the 20 blocks starting at the given height
+    std::vector<uint256> vecExpected;
+    vecExpected.push_back(vote2.GetHash());
+    vecExpected.push_back(vote3.GetHash());
+    std::sort(vecExpected.begin(), vecExpected.end());
+    BOOST_CHECK(GetSyncHashes(mnpayments, 150) == vecExpected);
+
+    BOOST_CHECK(GetSyncHashes(mnpayments, 171).empty());
+    BOOST_CHECK(GetSyncHashes(mnpayments, 130) == std::vector<uint256>(1, vote1.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(vote_expiry)
+{
+    CMasternodePayments mnpayments;
+    CMasternodePaymentVote vote1 = MakeVote(120);
+    CMasternodePaymentVote vote2 = MakeVote(121);
+    CMasternodePaymentVote vote3 = MakeVote(150);
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote1));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote2));
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote3));
+    BOOST_CHECK_EQUAL(mnpayments.GetBlockCount(), 3);
+
+    mnpayments.RemoveBelowHeight(121);
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 2);
+    BOOST_CHECK_EQUAL(mnpayments.GetBlockCount(), 2);
+    BOOST_CHECK(!mnpayments.HasVerifiedPaymentVote(vote1.GetHash()));
+    BOOST_CHECK(mnpayments.HasVerifiedPaymentVote(vote2.GetHash()));
+
+    mnpayments.RemoveBelowHeight(151);
+    BOOST_CHECK_EQUAL(mnpayments.GetVoteCount(), 0);
+    BOOST_CHECK_EQUAL(mnpayments.GetBlockCount(), 0);
+    BOOST_CHECK(GetSyncHashes(mnpayments, 101).empty());
+
+    // Expired votes can be stored again and are indexed again
+    BOOST_CHECK(mnpayments.AddPaymentVote(vote3));
+    BOOST_CHECK_EQUAL(GetSyncHashes(mnpayments, 150).size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(vote_rebuild_on_load)
+{
+    CMasternodePayments mnpayments;
+    for (int nHeight = 140; nHeight < 160; nHeight += 3)
+        BOOST_CHECK(mnpayments.AddPaymentVote(MakeVote(nHeight)));
+    BOOST_CHECK(mnpayments.AddPaymentVote(MakeVote(145, false)));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << mnpayments;
+    CMasternodePayments mnpaymentsLoaded;
+    ss >> mnpaymentsLoaded;
+
+    BOOST_CHECK_EQUAL(mnpaymentsLoaded.GetVoteCount(), mnpayments.GetVoteCount());
+    for (int nHeight = 130; nHeight < 160; nHeight++)
+        BOOST_CHECK(GetSyncHashes(mnpaymentsLoaded, nHeight) == GetSyncHashes(mnpayments, nHeight));
+
+    // The rebuilt index expires the same way
+    mnpaymentsLoaded.RemoveBelowHeight(150);
+    BOOST_CHECK_EQUAL(mnpaymentsLoaded.GetVoteCount(), 3);
+    BOOST_CHECK_EQUAL(GetSyncHashes(mnpaymentsLoaded, 140).size(), 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,154 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+
+#include "masternodeman.h"
+#include "netbase.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+#include "test/test_futurocoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, BasicTestingSetup)
+
+static CMasternodeBroadcast MakeBroadcast(int n)
+{
+    CKey keyCollateral, keyMasternode;
+    keyCollateral.MakeNewKey(true);
+    keyMasternode.MakeNewKey(true);
+    COutPoint outpoint(GetRandHash(), n);
+    CMasternodeBroadcast mnb(LookupNumeric(strprintf("1.2.3.%d", n).c_str(), 9999), outpoint,
+                             keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+    mnb.sigTime = 1500000000 + n;
+    return mnb;
+}
+
+BOOST_AUTO_TEST_CASE(mnb_batch_roundtrip)
+{
+    bool fMasterNodesReleasedOld = fMasterNodesReleased;
+    for (int nReleased = 0; nReleased < 2; nReleased++) {
+        fMasterNodesReleased = nReleased;
+
+        std::vector<CMasternodeBroadcast> vecMnb;
+        for (int i = 1; i <= 3; i++)
+            vecMnb.push_back(MakeBroadcast(i));
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vecMnb;
+        std::vector<CMasternodeBroadcast> vecMnbRead;
+        BOOST_CHECK(CMasternodeMan::ReadMnbBatch(ss, vecMnbRead));
+        BOOST_CHECK(ss.empty());
+        BOOST_REQUIRE_EQUAL(vecMnbRead.size(), vecMnb.size());
+        for (size_t i = 0; i < vecMnb.size(); i++) {
+            BOOST_CHECK(vecMnbRead[i].GetHash() == vecMnb[i].GetHash());
+            BOOST_CHECK(vecMnbRead[i].addr == vecMnb[i].addr);
+            BOOST_CHECK_EQUAL(vecMnbRead[i].sigTime, vecMnb[i].sigTime);
+        }
+
+        // An empty batch is fine too
+        CDataStream ssEmpty(SER_NETWORK, PROTOCOL_VERSION);
+        ssEmpty << std::vector<CMasternodeBroadcast>();
+        BOOST_CHECK(CMasternodeMan::ReadMnbBatch(ssEmpty, vecMnbRead));
+        BOOST_CHECK(vecMnbRead.empty());
+    }
+    fMasterNodesReleased = fMasterNodesReleasedOld;
+}
+
+BOOST_AUTO_TEST_CASE(mnb_batch_oversized)
+{
+    // Only the announced size is read, none of the entries are allocated
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, 100000);
+    ss << MakeBroadcast(1);
+    size_t nSizeBefore = ss.size();
+    std::vector<CMasternodeBroadcast> vecMnb;
+    BOOST_CHECK(!CMasternodeMan::ReadMnbBatch(ss, vecMnb));
+    BOOST_CHECK(vecMnb.empty());
+    BOOST_CHECK_EQUAL(ss.size(), nSizeBefore - GetSizeOfCompactSize(100000));
+}
+
+BOOST_AUTO_TEST_CASE(payee_index_mnrel)
+{
+    bool fMasterNodesReleasedOld = fMasterNodesReleased;
+    fMasterNodesReleased = true;
+
+    // mn1 and mn2 share a collateral address and so the payee script
+    CMasternodeBroadcast mnb1 = MakeBroadcast(1);
+    CMasternodeBroadcast mnb2 = MakeBroadcast(2);
+    CMasternodeBroadcast mnb3 = MakeBroadcast(3);
+    mnb2.pubKeyCollateralAddress = mnb1.pubKeyCollateralAddress;
+    CMasternode mn1(mnb1), mn2(mnb2), mn3(mnb3);
+    CScript payee12 = GetScriptForDestination(mnb1.pubKeyCollateralAddress.GetID());
+    CScript payee3 = GetScriptForDestination(mnb3.pubKeyCollateralAddress.GetID());
+    COutPoint outpointFirst = std::min(mn1.vin.prevout, mn2.vin.prevout);
+    COutPoint outpointSecond = std::max(mn1.vin.prevout, mn2.vin.prevout);
+
+    CMasternodeMan mnman;
+    BOOST_CHECK(mnman.Add(mn1));
+    BOOST_CHECK(mnman.Add(mn2));
+    BOOST_CHECK(mnman.Add(mn3));
+    BOOST_CHECK(!mnman.Add(mn1));
+
+    masternode_info_t mnInfo;
+    BOOST_CHECK(mnman.GetMasternodeInfoMnRel(payee12, mnInfo));
+    BOOST_CHECK(mnInfo.vin.prevout == outpointFirst);
+    BOOST_CHECK(mnman.GetMasternodeInfoMnRel(payee3, mnInfo));
+    BOOST_CHECK(mnInfo.vin.prevout == mn3.vin.prevout);
+
+    // Removing one of the shared entries leaves the other one findable
+    mnman.Remove(outpointFirst);
+    BOOST_CHECK(!mnman.Has(outpointFirst));
+    BOOST_CHECK(mnman.GetMasternodeInfoMnRel(payee12, mnInfo));
+    BOOST_CHECK(mnInfo.vin.prevout == outpointSecond);
+
+    mnman.Remove(outpointSecond);
+    mnman.Remove(outpointSecond);
+    BOOST_CHECK(!mnman.GetMasternodeInfoMnRel(payee12, mnInfo));
+    BOOST_CHECK(mnman.GetMasternodeInfoMnRel(payee3, mnInfo));
+    BOOST_CHECK_EQUAL(mnman.size(), 1);
+
+    // And it's indexed again once it comes back
+    BOOST_CHECK(mnman.Add(mn2));
+    BOOST_CHECK(mnman.GetMasternodeInfoMnRel(payee12, mnInfo));
+    BOOST_CHECK(mnInfo.vin.prevout == mn2.vin.prevout);
+
+    mnman.Clear();
+    BOOST_CHECK(!mnman.GetMasternodeInfoMnRel(payee3, mnInfo));
+
+    fMasterNodesReleased = fMasterNodesReleasedOld;
+}
+
+BOOST_AUTO_TEST_CASE(payee_index)
+{
+    bool fMasterNodesReleasedOld = fMasterNodesReleased;
+    fMasterNodesReleased = false;
+
+    CMasternode mn1(MakeBroadcast(1)), mn2(MakeBroadcast(2));
+    CScript payee1 = GetScriptForDestination(mn1.pubKeyMasternode.GetID());
+    CScript payee2 = GetScriptForDestination(mn2.pubKeyMasternode.GetID());
+
+    CMasternodeMan mnman;
+    BOOST_CHECK(mnman.Add(mn1));
+    BOOST_CHECK(mnman.Add(mn2));
+
+    masternode_info_t mnInfo;
+    BOOST_CHECK(mnman.GetMasternodeInfo(payee1, mnInfo));
+    BOOST_CHECK(mnInfo.pubKeyMasternode == mn1.pubKeyMasternode);
+    BOOST_CHECK(mnman.GetMasternodeInfo(payee2, mnInfo));
+    BOOST_CHECK(mnInfo.pubKeyMasternode == mn2.pubKeyMasternode);
+
+    mnman.Remove(mn1.pubKeyMasternode);
+    BOOST_CHECK(!mnman.Has(mn1.pubKeyMasternode));
+    BOOST_CHECK(!mnman.GetMasternodeInfo(payee1, mnInfo));
+    BOOST_CHECK(mnman.GetMasternodeInfo(payee2, mnInfo));
+    BOOST_CHECK_EQUAL(mnman.size(), 1);
+
+    fMasterNodesReleased = fMasterNodesReleasedOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
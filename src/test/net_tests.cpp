@@ -174,4 +174,45 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_reuse)
+{
+    CDataStream payload(SER_NETWORK, PROTOCOL_VERSION);
+    payload << std::string("reuse me");
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::PING, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream wire(SER_NETWORK, PROTOCOL_VERSION);
+    wire << hdr;
+    wire += payload;
+
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), "", false);
+
+    std::list<CNetMessage> msgs;
+    msgs.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+    // A reset message receives the next one exactly like a fresh one
+    for (int i = 0; i < 2; i++) {
+        CNetMessage& msg = msgs.front();
+        int nHdr = msg.readHeader(&wire[0], wire.size());
+        BOOST_CHECK_EQUAL(nHdr, (int)CMessageHeader::HEADER_SIZE);
+        BOOST_CHECK_EQUAL(msg.readData(&wire[nHdr], wire.size() - nHdr), (int)payload.size());
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK(std::string(msg.vRecv.begin(), msg.vRecv.end()) == payload.str());
+        msg.Reset(INIT_PROTO_VERSION);
+        BOOST_CHECK(!msg.complete());
+    }
+
+    node.RecycleRecvMsgs(msgs);
+    BOOST_CHECK(msgs.empty());
+    BOOST_CHECK_EQUAL(node.vRecvMsgPool.size(), 1U);
+
+    // Oversized buffers are not kept
+    msgs.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+    msgs.front().vRecv.reserve(MAX_POOLED_RECV_BUFFER + 1);
+    node.RecycleRecvMsgs(msgs);
+    BOOST_CHECK(msgs.empty());
+    BOOST_CHECK_EQUAL(node.vRecvMsgPool.size(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,9 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "policy/fees.h"
 #include "txmempool.h"
 #include "uint256.h"
+#include "streams.h"
 #include "util.h"
 
 #include "test/test_futurocoin.h"
@@ -207,4 +209,104 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesPersistence)
+{
+    CTxMemPool mpool(CFeeRate(10000));
+    TestMemPoolEntryHelper entry;
+    CAmount basefee(20000);
+    std::list<CTransaction> dummyConflicted;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue=0LL;
+
+    // Higher fee transactions get confirmed sooner
+    std::vector<CTransaction> blocks[10];
+    int blocknum = 0;
+    while (blocknum < 100) {
+        for (int j = 0; j < 10; j++) {
+            tx.vin[0].prevout.n = 10000*blocknum+j;
+            mpool.addUnchecked(tx.GetHash(), entry.Fee(basefee * (j+1)).Time(GetTime()).Height(blocknum).FromTx(tx, &mpool));
+            blocks[(blocknum + 9 - j) % 10].push_back(CTransaction(tx));
+        }
+        mpool.removeForBlock(blocks[blocknum % 10], blocknum + 1, dummyConflicted);
+        blocks[blocknum % 10].clear();
+        blocknum++;
+    }
+
+    // Round trip through the on-disk format
+    CAutoFile fileout(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(fileout));
+    rewind(fileout.Get());
+    CTxMemPool mpool2(CFeeRate(10000));
+    BOOST_CHECK(mpool2.ReadFeeEstimates(fileout));
+
+    for (int i = 1; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i) == mpool2.estimateFee(i));
+    }
+    BOOST_CHECK(mpool.estimateFee(10) > CFeeRate(0));
+
+    // The flat layout must look up-version to every released client
+    rewind(fileout.Get());
+    int nVersionRequired;
+    fileout >> nVersionRequired;
+    BOOST_CHECK(nVersionRequired > CLIENT_VERSION);
+
+    // while files from real future versions are still refused
+    CAutoFile upfile(tmpfile(), SER_DISK, CLIENT_VERSION);
+    upfile << CLIENT_VERSION + 1 << CLIENT_VERSION + 1;
+    rewind(upfile.Get());
+    CTxMemPool mpool3(CFeeRate(10000));
+    BOOST_CHECK(!mpool3.ReadFeeEstimates(upfile));
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesLegacyFile)
+{
+    // fee_estimates.dat as written before the flat layout: the confirmation
+    // averages are stored as one vector per confirmation target
+    std::vector<double> vBuckets;
+    vBuckets.push_back(1000);
+    vBuckets.push_back(10000);
+    vBuckets.push_back(100000);
+    vBuckets.push_back(1e7);
+    vBuckets.push_back(INF_FEERATE);
+
+    // 1000 transactions averaging 50000 sat/kB in the third bucket, all confirmed in the next block
+    std::vector<double> vAvg(vBuckets.size(), 0);
+    std::vector<double> vTxCtAvg(vBuckets.size(), 0);
+    vAvg[2] = 1000 * 50000.0;
+    vTxCtAvg[2] = 1000;
+    std::vector<std::vector<double> > vConfAvg(MAX_BLOCK_CONFIRMS, vTxCtAvg);
+
+    CAutoFile fileout(tmpfile(), SER_DISK, CLIENT_VERSION);
+    fileout << 120000; // version required to read
+    fileout << CLIENT_VERSION; // version that wrote the file
+    fileout << 100; // nBestSeenHeight
+    for (int i = 0; i < 2; i++) { // fee and priority stats
+        fileout << DEFAULT_DECAY;
+        fileout << vBuckets;
+        fileout << vAvg;
+        fileout << vTxCtAvg;
+        fileout << vConfAvg;
+    }
+    rewind(fileout.Get());
+
+    CTxMemPool mpool(CFeeRate(1000));
+    BOOST_CHECK(mpool.ReadFeeEstimates(fileout));
+    for (int i = 1; i <= (int)MAX_BLOCK_CONFIRMS; i++) {
+        BOOST_CHECK(mpool.estimateFee(i) == CFeeRate(50000));
+    }
+
+    // A legacy file with a truncated confirmation target is rejected
+    vConfAvg[3].pop_back();
+    CAutoFile badfile(tmpfile(), SER_DISK, CLIENT_VERSION);
+    badfile << 120000 << CLIENT_VERSION << 100;
+    badfile << DEFAULT_DECAY << vBuckets << vAvg << vTxCtAvg << vConfAvg;
+    rewind(badfile.Get());
+    CTxMemPool mpool2(CFeeRate(1000));
+    BOOST_CHECK(!mpool2.ReadFeeEstimates(badfile));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -317,6 +317,17 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     CSerializeData d;
     ss.GetAndClear(d);
     BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 4);
+    BOOST_CHECK_EQUAL(d[3], (char)0xff);
+
+    // ...including when appending a partially read stream
+    ss << (uint8_t)7 << (uint8_t)8;
+    uint8_t n;
+    ss >> n;
+    ss.GetAndClear(d);
+    BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 5);
+    BOOST_CHECK_EQUAL(d[4], 8);
 }
 
 // Change struct size and check if it can be deserialized
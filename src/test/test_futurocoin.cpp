@@ -15,6 +15,7 @@
 #include "net_processing.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/interpreter.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -143,6 +144,30 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     return result;
 }
 
+//
+// Spend the first output of coinbase transaction nCoinbase to
+// scriptPubKeyTo in a new block, coinbase paying to coinbaseKey again.
+//
+CTransaction
+TestChain100Setup::AddTxToChain(int nCoinbase, const CScript& scriptPubKeyTo, const CAmount& nValue)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[nCoinbase].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = nValue;
+    spend.vout[0].scriptPubKey = scriptPubKeyTo;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    return spend;
+}
+
 TestChain100Setup::~TestChain100Setup()
 {
 }
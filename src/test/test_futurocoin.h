@@ -51,6 +51,10 @@ struct TestChain100Setup : public TestingSetup {
     CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
                                  const CScript& scriptPubKey);
 
+    // Spend the first output of coinbase transaction nCoinbase to
+    // scriptPubKeyTo in a new block, coinbase paying to coinbaseKey again.
+    CTransaction AddTxToChain(int nCoinbase, const CScript& scriptPubKeyTo, const CAmount& nValue);
+
     ~TestChain100Setup();
 
     std::vector<CTransaction> coinbaseTxns; // For convenience, coinbase transactions
@@ -39,6 +39,7 @@
 #endif // __linux__
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
@@ -201,6 +202,114 @@ instance_of_cinit;
 
 static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 
+//! Log lines that can be waiting for the writer thread
+static const size_t DEBUG_LOG_QUEUE_SLOTS = 16384;
+//! Bytes of log lines that can be waiting for the writer thread; more are dropped
+static const size_t MAX_DEBUG_LOG_QUEUE_BYTES = 16 * 1024 * 1024;
+//! Queued bytes at which producers wake up the writer thread early
+static const size_t DEBUG_LOG_WAKE_BYTES = 32 * 1024;
+//! stdio buffer size for debug.log
+static const size_t DEBUG_LOG_WRITE_BATCH_SIZE = 64 * 1024;
+//! How long queued log lines may wait before the writer thread picks them up
+static const int DEBUG_LOG_FLUSH_INTERVAL_MS = 100;
+
+/**
+ * Bounded lock-free queue of log lines, multiple producers and a single
+ * consumer (whoever holds mutexDebugLog). Each slot carries a sequence
+ * number telling producers and the consumer whose turn it is.
+ */
+class CDebugLogQueue
+{
+private:
+    struct Slot
+    {
+        std::atomic<size_t> nSeq;
+        std::string str;
+    };
+
+    Slot* pslots;
+    const size_t nMask;
+    std::atomic<size_t> nEnqueuePos;
+    std::atomic<size_t> nDequeuePos;
+    std::atomic<size_t> nQueuedBytes;
+
+public:
+    //! nSize must be a power of two
+    explicit CDebugLogQueue(size_t nSize) : pslots(new Slot[nSize]), nMask(nSize - 1), nEnqueuePos(0), nDequeuePos(0), nQueuedBytes(0)
+    {
+        for (size_t i = 0; i < nSize; i++)
+            pslots[i].nSeq.store(i, std::memory_order_relaxed);
+    }
+
+    //! Takes the contents of str on success; fails when out of slots or bytes
+    bool Push(std::string& str)
+    {
+        if (nQueuedBytes.fetch_add(str.size(), std::memory_order_relaxed) + str.size() > MAX_DEBUG_LOG_QUEUE_BYTES) {
+            nQueuedBytes.fetch_sub(str.size(), std::memory_order_relaxed);
+            return false;
+        }
+
+        Slot* pslot;
+        size_t nPos = nEnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            pslot = &pslots[nPos & nMask];
+            size_t nSeq = pslot->nSeq.load(std::memory_order_acquire);
+            intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nPos;
+            if (nDiff == 0) {
+                if (nEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (nDiff < 0) {
+                nQueuedBytes.fetch_sub(str.size(), std::memory_order_relaxed);
+                return false;
+            } else {
+                nPos = nEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        pslot->str.swap(str);
+        pslot->nSeq.store(nPos + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! Only one thread may pop at a time
+    bool Pop(std::string& str)
+    {
+        size_t nPos = nDequeuePos.load(std::memory_order_relaxed);
+        Slot* pslot = &pslots[nPos & nMask];
+        if (pslot->nSeq.load(std::memory_order_acquire) != nPos + 1)
+            return false;
+        nDequeuePos.store(nPos + 1, std::memory_order_relaxed);
+        str.swap(pslot->str);
+        pslot->str.clear();
+        pslot->nSeq.store(nPos + nMask + 1, std::memory_order_release);
+        nQueuedBytes.fetch_sub(str.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t GetQueuedBytes() const
+    {
+        return nQueuedBytes.load(std::memory_order_relaxed);
+    }
+
+    //! Write the queued lines to fd without taking them out; async-signal-safe
+    void WriteQueued(int fd) const
+    {
+        for (size_t nPos = nDequeuePos.load(std::memory_order_relaxed); ; nPos++) {
+            const Slot* pslot = &pslots[nPos & nMask];
+            if (pslot->nSeq.load(std::memory_order_acquire) != nPos + 1)
+                return;
+            const char* pch = pslot->str.data();
+            size_t nLeft = pslot->str.size();
+            while (nLeft > 0) {
+                ssize_t nWritten = write(fd, pch, nLeft);
+                if (nWritten <= 0)
+                    return;
+                pch += nWritten;
+                nLeft -= nWritten;
+            }
+        }
+    }
+};
+
 /**
  * We use boost::call_once() to make sure mutexDebugLog and
  * vMsgsBeforeOpenLog are initialized in a thread-safe manner.
@@ -210,10 +319,20 @@ static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
  * the OS/libc. When the shutdown sequence is fully audited and
  * tested, explicit destruction of these objects can be implemented.
  */
+
 static FILE* fileout = NULL;
+static volatile int nDebugLogFd = -1; // fileout's descriptor, for crash signal handlers
 static boost::mutex* mutexDebugLog = NULL;
 static list<string> *vMsgsBeforeOpenLog;
 
+static CDebugLogQueue* pdebugLogQueue = NULL;
+static std::atomic<bool> fDebugLogAsync(false);
+static std::atomic<uint64_t> nDebugLogDropped(0);
+static boost::thread* pthreadDebugLog = NULL;
+static boost::mutex* mutexDebugLogWake = NULL;
+static boost::condition_variable* condDebugLogWake = NULL;
+static bool fDebugLogWriterStop = false;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -224,6 +343,56 @@ static void DebugPrintInit()
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
     vMsgsBeforeOpenLog = new list<string>;
+    pdebugLogQueue = new CDebugLogQueue(DEBUG_LOG_QUEUE_SLOTS);
+    mutexDebugLogWake = new boost::mutex();
+    condDebugLogWake = new boost::condition_variable();
+}
+
+static void ReopenDebugLogIfRequested()
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL) {
+            setvbuf(fileout, NULL, _IOFBF, DEBUG_LOG_WRITE_BATCH_SIZE);
+            nDebugLogFd = fileno(fileout);
+        }
+    }
+}
+
+/** Write out everything queued so far. Requires mutexDebugLog. */
+static void DrainDebugLogQueue()
+{
+    if (fileout == NULL)
+        return;
+
+    ReopenDebugLogIfRequested();
+
+    std::string strLine;
+    while (pdebugLogQueue->Pop(strLine))
+        FileWriteStr(strLine, fileout);
+
+    uint64_t nDropped = nDebugLogDropped.exchange(0);
+    if (nDropped > 0)
+        FileWriteStr(strprintf("[%u log messages dropped, logging queue full]\n", nDropped), fileout);
+    fflush(fileout);
+}
+
+static void ThreadDebugLogWriter()
+{
+    RenameThread("futurocoin-log");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(*mutexDebugLogWake);
+            if (fDebugLogWriterStop)
+                break;
+            // wake up on our own now and then, a producer's notify may be missed
+            condDebugLogWake->timed_wait(lock, boost::posix_time::milliseconds(DEBUG_LOG_FLUSH_INTERVAL_MS));
+        }
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        DrainDebugLogQueue();
+    }
 }
 
 void OpenDebugLog()
@@ -235,7 +404,7 @@ void OpenDebugLog()
     assert(vMsgsBeforeOpenLog);
     boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
     fileout = fopen(pathDebug.string().c_str(), "a");
-    if (fileout) setbuf(fileout, NULL); // unbuffered
+    if (fileout) setvbuf(fileout, NULL, _IOFBF, DEBUG_LOG_WRITE_BATCH_SIZE);
 
     // dump buffered messages from before we opened the log
     while (!vMsgsBeforeOpenLog->empty()) {
@@ -245,6 +414,61 @@ void OpenDebugLog()
 
     delete vMsgsBeforeOpenLog;
     vMsgsBeforeOpenLog = NULL;
+
+    if (fileout == NULL)
+        return;
+    fflush(fileout);
+    nDebugLogFd = fileno(fileout);
+
+    // from now on log lines are queued and written by a background thread
+    fDebugLogWriterStop = false;
+    pthreadDebugLog = new boost::thread(&ThreadDebugLogWriter);
+    fDebugLogAsync = true;
+}
+
+void StopDebugLogWriter()
+{
+    if (pthreadDebugLog == NULL)
+        return;
+
+    fDebugLogAsync = false;
+    {
+        boost::lock_guard<boost::mutex> lock(*mutexDebugLogWake);
+        fDebugLogWriterStop = true;
+    }
+    condDebugLogWake->notify_one();
+    pthreadDebugLog->join();
+    delete pthreadDebugLog;
+    pthreadDebugLog = NULL;
+
+    FlushDebugLog();
+}
+
+void FlushDebugLog(bool fCrash)
+{
+    if (mutexDebugLog == NULL)
+        return;
+
+    // A crashing thread may already hold the lock, don't wait for it then
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog, boost::defer_lock);
+    if (fCrash) {
+        if (!scoped_lock.try_lock())
+            return;
+    } else {
+        scoped_lock.lock();
+    }
+    DrainDebugLogQueue();
+}
+
+void FlushDebugLogFromSignal()
+{
+    // Only write(2) is allowed here: the signal may have hit a thread inside
+    // malloc, stdio or while holding mutexDebugLog. Whatever sits in fileout's
+    // stdio buffer at that moment is lost.
+    int fd = nDebugLogFd;
+    if (fd < 0 || pdebugLogQueue == NULL)
+        return;
+    pdebugLogQueue->WriteQueued(fd);
 }
 
 bool LogAcceptCategory(const char* category)
@@ -359,6 +583,18 @@ int LogPrintStr(const std::string &str)
         ret = fwrite(strTimestamped.data(), 1, strTimestamped.size(), stdout);
         fflush(stdout);
     }
+    else if (fPrintToDebugLog && fDebugLogAsync)
+    {
+        // hand the line to the writer thread without taking any lock
+        ret = strTimestamped.length();
+        if (!pdebugLogQueue->Push(strTimestamped)) {
+            ++nDebugLogDropped;
+            ret = 0;
+        }
+        // the writer wakes up by itself, only hurry it along when lines pile up
+        if (pdebugLogQueue->GetQueuedBytes() >= DEBUG_LOG_WAKE_BYTES)
+            condDebugLogWake->notify_one();
+    }
     else if (fPrintToDebugLog)
     {
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
@@ -372,15 +608,10 @@ int LogPrintStr(const std::string &str)
         }
         else
         {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
+            // keep the order with anything still queued
+            DrainDebugLogQueue();
             ret = FileWriteStr(strTimestamped, fileout);
+            fflush(fileout);
         }
     }
     return ret;
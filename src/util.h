@@ -97,17 +97,27 @@ int LogPrintStr(const std::string &str);
 
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
+/**
+ * Print to debug.log if -debug=category switch is given OR category is NULL.
+ * This is a macro rather than a function so that the arguments, which are
+ * often ToString() calls, are not even evaluated unless the category is on.
+ */
+#define LogPrint(category, ...) do {                                          \
+    if (LogAcceptCategory((category))) {                                      \
+        LogPrintStr(LogFormat(__VA_ARGS__));                                  \
+    }                                                                         \
+} while(0)
+
 /**
  * When we switch to C++11, this can be switched to variadic templates instead
  * of this macro-based construction (see tinyformat.h).
  */
 #define MAKE_ERROR_AND_LOG_FUNC(n)                                        \
-    /**   Print to debug.log if -debug=category switch is given OR category is NULL. */ \
+    /**   Format a log line, see LogPrint */                                  \
     template<TINYFORMAT_ARGTYPES(n)>                                          \
-    static inline int LogPrint(const char* category, const char* format, TINYFORMAT_VARARGS(n))  \
+    static inline std::string LogFormat(const char* format, TINYFORMAT_VARARGS(n))  \
     {                                                                         \
-        if(!LogAcceptCategory(category)) return 0;                            \
-        return LogPrintStr(tfm::format(format, TINYFORMAT_PASSARGS(n))); \
+        return tfm::format(format, TINYFORMAT_PASSARGS(n));                   \
     }                                                                         \
     /**   Log error and return false */                                        \
     template<TINYFORMAT_ARGTYPES(n)>                                          \
@@ -123,10 +133,9 @@ TINYFORMAT_FOREACH_ARGNUM(MAKE_ERROR_AND_LOG_FUNC)
  * Zero-arg versions of logging and error, these are not covered by
  * TINYFORMAT_FOREACH_ARGNUM
  */
-static inline int LogPrint(const char* category, const char* format)
+static inline std::string LogFormat(const char* format)
 {
-    if(!LogAcceptCategory(category)) return 0;
-    return LogPrintStr(format);
+    return format;
 }
 static inline bool error(const char* format)
 {
@@ -158,6 +167,12 @@ boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 boost::filesystem::path GetTempPath();
 void OpenDebugLog();
+/** Stop the background debug.log writer; later log lines are written synchronously */
+void StopDebugLogWriter();
+/** Write out queued log lines now. With fCrash set, give up instead of waiting for the log lock. */
+void FlushDebugLog(bool fCrash = false);
+/** Write queued log lines with write(2) only; safe to call from a signal handler */
+void FlushDebugLogFromSignal();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 
@@ -1201,6 +1201,40 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vchBlock.clear();
+
+    // The index header written by WriteBlockToDisk precedes the block itself
+    if (pos.nPos < sizeof(messageStart) + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk: invalid position %s", pos.ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - sizeof(messageStart) - sizeof(unsigned int));
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int nSize;
+        filein >> FLATDATA(blk_start) >> nSize;
+
+        if (memcmp(blk_start, messageStart, sizeof(messageStart)))
+            return error("ReadRawBlockFromDisk: block magic mismatch at %s", pos.ToString());
+        if (nSize > MAX_BLOCKFILE_SIZE)
+            return error("ReadRawBlockFromDisk: block size %u too large at %s", nSize, pos.ToString());
+
+        vchBlock.resize(nSize);
+        filein.read((char*)vchBlock.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        vchBlock.clear();
+        return error("%s: Read or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 double ConvertBitsToDouble(unsigned int nBits)
 {
     int nShift = (nBits >> 24) & 0xff;
@@ -2526,6 +2560,8 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     // UpdateTransactionsFromBlock finds descendants of any transactions in this
     // block that were added back and cleans up the mempool state.
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    mnpayments.payeeIndex.DisconnectBlock(pindexDelete);
+    mnodeman.DisconnectBlock(block);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
@@ -2584,6 +2620,12 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    // Remember who got paid; during initial download nobody asks, blocks
+    // that turn out to be needed later are read back on demand
+    if (!IsInitialBlockDownload())
+        mnpayments.payeeIndex.ConnectBlock(*pblock, pindexNew);
+    // Let the masternode list know about spent collaterals
+    mnodeman.ConnectBlock(*pblock);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
     // Tell wallet about transactions that went from mempool
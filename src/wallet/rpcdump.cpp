@@ -73,6 +73,15 @@ std::string DecodeDumpString(const std::string &str) {
     return ret.str();
 }
 
+static CBlockIndex* GetChainGenesis()
+{
+    LOCK(cs_main);
+    return chainActive.Genesis();
+}
+
+static bool ImportWalletFile(const UniValue& params, CBlockIndex*& pindex);
+static bool ImportElectrumWalletFile(const UniValue& params, CBlockIndex*& pindexStart);
+
 UniValue importprivkey(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -99,15 +108,6 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
         );
 
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    string strSecret = params[0].get_str();
-    string strLabel = "";
-    if (params.size() > 1)
-        strLabel = params[1].get_str();
-
     // Whether to perform rescan after import
     bool fRescan = true;
     if (params.size() > 2)
@@ -116,18 +116,28 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
 
-    CBitcoinSecret vchSecret;
-    bool fGood = vchSecret.SetString(strSecret);
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+        EnsureWalletIsUnlocked();
 
-    CKey key = vchSecret.GetKey();
-    if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+        string strSecret = params[0].get_str();
+        string strLabel = "";
+        if (params.size() > 1)
+            strLabel = params[1].get_str();
+
+        CBitcoinSecret vchSecret;
+        bool fGood = vchSecret.SetString(strSecret);
+
+        if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+
+        CKey key = vchSecret.GetKey();
+        if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+
+        CPubKey pubkey = key.GetPubKey();
+        assert(key.VerifyPubKey(pubkey));
+        CKeyID vchAddress = pubkey.GetID();
 
-    CPubKey pubkey = key.GetPubKey();
-    assert(key.VerifyPubKey(pubkey));
-    CKeyID vchAddress = pubkey.GetID();
-    {
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
@@ -142,10 +152,11 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+    // The rescan takes the locks it needs itself, block by block
+    if (fRescan) {
+        pwalletMain->ScanForWalletTransactions(GetChainGenesis(), true);
     }
 
     return NullUniValue;
@@ -221,23 +232,25 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     if (params.size() > 3)
         fP2SH = params[3].get_bool();
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    CBitcoinAddress address(params[0].get_str());
-    if (address.IsValid()) {
-        if (fP2SH)
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
-        ImportAddress(address, strLabel);
-    } else if (IsHex(params[0].get_str())) {
-        std::vector<unsigned char> data(ParseHex(params[0].get_str()));
-        ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
-    } else {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid FuturoCoin address or script");
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        CBitcoinAddress address(params[0].get_str());
+        if (address.IsValid()) {
+            if (fP2SH)
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
+            ImportAddress(address, strLabel);
+        } else if (IsHex(params[0].get_str())) {
+            std::vector<unsigned char> data(ParseHex(params[0].get_str()));
+            ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
+        } else {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid FuturoCoin address or script");
+        }
     }
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(GetChainGenesis(), true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -287,14 +300,16 @@ UniValue importpubkey(const UniValue& params, bool fHelp)
     if (!pubKey.IsFullyValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey is not a valid public key");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
-    ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+        ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
+        ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+    }
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(GetChainGenesis(), true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -325,6 +340,22 @@ UniValue importwallet(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
+    CBlockIndex *pindex = NULL;
+    bool fGood = ImportWalletFile(params, pindex);
+
+    // The rescan takes the locks it needs itself, block by block
+    pwalletMain->ScanForWalletTransactions(pindex);
+    pwalletMain->MarkDirty();
+
+    if (!fGood)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
+
+    return NullUniValue;
+}
+
+/** Import the keys of a wallet dump, pindex is set to the block the rescan should start at */
+static bool ImportWalletFile(const UniValue& params, CBlockIndex*& pindex)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -392,7 +423,7 @@ UniValue importwallet(const UniValue& params, bool fHelp)
     file.close();
     pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
 
-    CBlockIndex *pindex = chainActive.Tip();
+    pindex = chainActive.Tip();
     while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
         pindex = pindex->pprev;
 
@@ -400,13 +431,7 @@ UniValue importwallet(const UniValue& params, bool fHelp)
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
-
-    if (!fGood)
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
-
-    return NullUniValue;
+    return fGood;
 }
 
 UniValue importelectrumwallet(const UniValue& params, bool fHelp)
@@ -433,6 +458,21 @@ UniValue importelectrumwallet(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
+    CBlockIndex *pindexStart = NULL;
+    bool fGood = ImportElectrumWalletFile(params, pindexStart);
+
+    // The rescan takes the locks it needs itself, block by block
+    pwalletMain->ScanForWalletTransactions(pindexStart, true);
+
+    if (!fGood)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
+
+    return NullUniValue;
+}
+
+/** Import the keys of an Electrum export, pindexStart is set to the block the rescan should start at */
+static bool ImportElectrumWalletFile(const UniValue& params, CBlockIndex*& pindexStart)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -535,12 +575,97 @@ UniValue importelectrumwallet(const UniValue& params, bool fHelp)
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning %i blocks\n", chainActive.Height() - nStartHeight + 1);
-    pwalletMain->ScanForWalletTransactions(chainActive[nStartHeight], true);
+    pindexStart = chainActive[nStartHeight];
+    return fGood;
+}
 
-    if (!fGood)
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
+UniValue rescanblockchain(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
 
-    return NullUniValue;
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "rescanblockchain (\"start_height\") (\"stop_height\")\n"
+            "\nRescan the local blockchain for wallet related transactions.\n"
+            "\nArguments:\n"
+            "1. start_height    (numeric, optional, default=0) block height where the rescan should start\n"
+            "2. stop_height     (numeric, optional) the last block height that should be scanned, defaults to the chain tip\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"start_height\"     (numeric) The block height where the rescan has started\n"
+            "  \"stop_height\"      (numeric) The height of the last block scanned, null if the rescan was interrupted before any\n"
+            "  \"found\"            (numeric) The number of wallet transactions added or updated\n"
+            "}\n"
+            "\nNote: The rescan can be interrupted with abortrescan.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("rescanblockchain", "100000 120000")
+            + HelpExampleRpc("rescanblockchain", "100000, 120000")
+        );
+
+    CBlockIndex *pindexStart = NULL;
+    CBlockIndex *pindexStop = NULL;
+    {
+        LOCK(cs_main);
+        int nStartHeight = 0;
+        if (params.size() > 0 && !params[0].isNull())
+            nStartHeight = params[0].get_int();
+        if (nStartHeight < 0 || nStartHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start_height");
+        pindexStart = chainActive[nStartHeight];
+
+        if (params.size() > 1 && !params[1].isNull()) {
+            int nStopHeight = params[1].get_int();
+            if (nStopHeight < 0 || nStopHeight > chainActive.Height())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid stop_height");
+            if (nStopHeight < nStartHeight)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "stop_height must be greater than start_height");
+            pindexStop = chainActive[nStopHeight];
+        }
+
+        // We can't rescan beyond non-pruned blocks
+        if (fPruneMode) {
+            CBlockIndex *block = pindexStop ? pindexStop : chainActive.Tip();
+            while (block && block != pindexStart) {
+                if (!(block->nStatus & BLOCK_HAVE_DATA))
+                    throw JSONRPCError(RPC_MISC_ERROR, "Can't rescan beyond pruned data. Use RPC call getblockchaininfo to determine your pruned height.");
+                block = block->pprev;
+            }
+        }
+    }
+
+    CBlockIndex *pindexScanned = NULL;
+    int nFound = pwalletMain->ScanForWalletTransactions(pindexStart, true, pindexStop, &pindexScanned);
+    if (pwalletMain->IsAbortingRescan())
+        throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted by user.");
+
+    UniValue response(UniValue::VOBJ);
+    response.push_back(Pair("start_height", pindexStart->nHeight));
+    response.push_back(Pair("stop_height", pindexScanned ? UniValue(pindexScanned->nHeight) : NullUniValue));
+    response.push_back(Pair("found", nFound));
+    return response;
+}
+
+UniValue abortrescan(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "\nStops the current wallet rescan triggered e.g. by an importprivkey or rescanblockchain call.\n"
+            "\nResult:\n"
+            "true|false    (boolean) Whether a rescan was running and has been asked to stop\n"
+            "\nExamples:\n"
+            + HelpExampleCli("abortrescan", "")
+            + HelpExampleRpc("abortrescan", "")
+        );
+
+    if (!pwalletMain->IsScanning() || pwalletMain->IsAbortingRescan())
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
 }
 
 UniValue dumpprivkey(const UniValue& params, bool fHelp)
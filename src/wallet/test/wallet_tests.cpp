@@ -4,6 +4,12 @@
 
 #include "wallet/wallet.h"
 
+#include "chain.h"
+#include "instantx.h"
+#include "random.h"
+#include "script/standard.h"
+#include "validation.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -361,4 +367,231 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+BOOST_AUTO_TEST_CASE(branch_and_bound)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    add_coin(4 * CENT, 3);
+    add_coin(8 * CENT);
+    sort(vCoins.begin(), vCoins.end(), CompareByValue());
+
+    // exact matches
+    BOOST_CHECK(wallet.SelectCoinsBnB(1 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+    BOOST_CHECK(wallet.SelectCoinsBnB(7 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsBnB(18 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 18 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 5U);
+
+    // the new 4 cent coin is skipped when it is not allowed
+    BOOST_CHECK(!wallet.SelectCoinsBnB(18 * CENT, 0, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(wallet.SelectCoinsBnB(14 * CENT, 0, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 14 * CENT);
+
+    // nothing in the window
+    BOOST_CHECK(!wallet.SelectCoinsBnB(19 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(!wallet.SelectCoinsBnB(CENT / 2, CENT / 4, 1, 1, vCoins, setCoinsRet, nValueRet));
+
+    // the closest match within the window wins
+    BOOST_CHECK(wallet.SelectCoinsBnB(CENT / 2, CENT / 2, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+    empty_wallet();
+    add_coin(5 * CENT);
+    add_coin(6 * CENT);
+    add_coin(12 * CENT);
+    sort(vCoins.begin(), vCoins.end(), CompareByValue());
+    BOOST_CHECK(wallet.SelectCoinsBnB(10 * CENT, 2 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 11 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // many identical coins do not blow up the search
+    empty_wallet();
+    for (int i = 0; i < 1000; i++)
+        add_coin(COIN);
+    BOOST_CHECK(wallet.SelectCoinsBnB(500 * COIN, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 500U);
+    BOOST_CHECK(!wallet.SelectCoinsBnB(500 * COIN + 1, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    empty_wallet();
+}
+
+BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
+{
+    CBlockIndex* pindexGenesis;
+    CBlockIndex* pindexMid;
+    {
+        LOCK(cs_main);
+        pindexGenesis = chainActive.Genesis();
+        pindexMid = chainActive[50];
+    }
+
+    // Every block after the genesis block pays its coinbase to coinbaseKey
+    CWallet scanWallet;
+    {
+        LOCK(scanWallet.cs_wallet);
+        scanWallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+
+    // A range stops at the given block
+    CBlockIndex* pindexScanned = NULL;
+    BOOST_CHECK_EQUAL(scanWallet.ScanForWalletTransactions(pindexGenesis, false, pindexMid, &pindexScanned), 50);
+    BOOST_CHECK(pindexScanned == pindexMid);
+    // Known transactions are only counted again when updating them
+    BOOST_CHECK_EQUAL(scanWallet.ScanForWalletTransactions(pindexGenesis), 50);
+    BOOST_CHECK_EQUAL(scanWallet.ScanForWalletTransactions(pindexGenesis, true), 100);
+    BOOST_CHECK(!scanWallet.IsScanning());
+
+    // A spend to a foreign key is found through the coinbase it spends,
+    // which only enters the wallet during the same scan
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    CTransaction spend = AddTxToChain(0, GetScriptForDestination(otherKey.GetPubKey().GetID()), 11*CENT);
+
+    CWallet freshWallet;
+    {
+        LOCK(freshWallet.cs_wallet);
+        freshWallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    BOOST_CHECK_EQUAL(freshWallet.ScanForWalletTransactions(pindexGenesis), 102);
+    BOOST_CHECK(freshWallet.GetWalletTx(spend.GetHash()) != NULL);
+}
+
+BOOST_FIXTURE_TEST_CASE(available_coins_index, TestChain100Setup)
+{
+    CWallet coinWallet;
+    {
+        LOCK(coinWallet.cs_wallet);
+        coinWallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    coinWallet.ScanForWalletTransactions(chainActive.Genesis());
+
+    // All coinbases are still immature
+    std::vector<COutput> vAvailable;
+    coinWallet.AvailableCoins(vAvailable);
+    BOOST_CHECK_EQUAL(vAvailable.size(), 0U);
+
+    // One more block matures the first one
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    coinWallet.AvailableCoins(vAvailable);
+    BOOST_REQUIRE_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK(vAvailable[0].tx->GetHash() == coinbaseTxns[0].GetHash());
+
+    // Spending it removes it, while the next coinbase matures
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    CTransaction spend = AddTxToChain(0, GetScriptForDestination(otherKey.GetPubKey().GetID()), 11*CENT);
+    coinWallet.ScanForWalletTransactions(chainActive.Tip());
+
+    coinWallet.AvailableCoins(vAvailable);
+    BOOST_REQUIRE_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK(vAvailable[0].tx->GetHash() == coinbaseTxns[1].GetHash());
+
+    // Watching a script makes outputs of known transactions available
+    // without a rescan
+    for (int i = 0; i < INSTANTSEND_CONFIRMATIONS_REQUIRED; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    {
+        LOCK(coinWallet.cs_wallet);
+        BOOST_CHECK(coinWallet.AddWatchOnly(GetScriptForDestination(otherKey.GetPubKey().GetID())));
+    }
+    coinWallet.AvailableCoins(vAvailable, false);
+    bool fFound = false;
+    BOOST_FOREACH(const COutput& out, vAvailable) {
+        if (out.tx->GetHash() == spend.GetHash()) {
+            fFound = true;
+            BOOST_CHECK(!out.fSpendable);
+        }
+    }
+    BOOST_CHECK(fFound);
+}
+
+static void CheckBalanceTotals(const CWallet& wallet)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CAmount nAvailable = 0, nImmature = 0, nUnconfirmed = 0;
+    for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        if (wtx.IsTrusted())
+            nAvailable += wtx.GetAvailableCredit(false);
+        else if (wtx.GetDepthInMainChain() == 0 && wtx.InMempool())
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+        nImmature += wtx.GetImmatureCredit(false);
+    }
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nAvailable);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+}
+
+BOOST_FIXTURE_TEST_CASE(balance_totals, TestChain100Setup)
+{
+    CWallet balanceWallet;
+    {
+        LOCK(balanceWallet.cs_wallet);
+        balanceWallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    balanceWallet.ScanForWalletTransactions(chainActive.Genesis());
+    CheckBalanceTotals(balanceWallet);
+    BOOST_CHECK_EQUAL(balanceWallet.GetBalance(), 0);
+    CAmount nImmature = balanceWallet.GetImmatureBalance();
+    BOOST_CHECK(nImmature > 0);
+
+    // A new block matures the first coinbase without touching the wallet
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    CheckBalanceTotals(balanceWallet);
+    CAmount nMatured = balanceWallet.GetCredit(coinbaseTxns[0], ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(balanceWallet.GetBalance(), nMatured);
+    BOOST_CHECK_EQUAL(balanceWallet.GetImmatureBalance(), nImmature - nMatured);
+
+    // Picking up the new coinbase and a spend of the matured one
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    AddTxToChain(0, GetScriptForDestination(otherKey.GetPubKey().GetID()), 11*CENT);
+    balanceWallet.ScanForWalletTransactions(chainActive[chainActive.Height() - 1]);
+    CheckBalanceTotals(balanceWallet);
+    BOOST_CHECK_EQUAL(balanceWallet.GetBalance(), balanceWallet.GetCredit(coinbaseTxns[1], ISMINE_SPENDABLE));
+}
+
+BOOST_FIXTURE_TEST_CASE(balance_totals_mempool, TestChain100Setup)
+{
+    CWallet balanceWallet;
+    {
+        LOCK(balanceWallet.cs_wallet);
+        balanceWallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    balanceWallet.ScanForWalletTransactions(chainActive.Genesis());
+
+    // A payment from someone else, known to the wallet but not in the mempool
+    CMutableTransaction payment;
+    payment.vin.resize(1);
+    payment.vin[0].prevout.hash = GetRandHash();
+    payment.vin[0].prevout.n = 0;
+    payment.vout.resize(1);
+    payment.vout[0].nValue = 11*CENT;
+    payment.vout[0].scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    balanceWallet.SyncTransaction(payment, NULL);
+    CheckBalanceTotals(balanceWallet);
+    BOOST_CHECK_EQUAL(balanceWallet.GetUnconfirmedBalance(), 0);
+
+    // Entering and leaving the mempool changes the balance without a new block
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(payment.GetHash(), entry.FromTx(payment));
+    CheckBalanceTotals(balanceWallet);
+    BOOST_CHECK_EQUAL(balanceWallet.GetUnconfirmedBalance(), 11*CENT);
+
+    std::list<CTransaction> removed;
+    mempool.remove(payment, removed);
+    CheckBalanceTotals(balanceWallet);
+    BOOST_CHECK_EQUAL(balanceWallet.GetUnconfirmedBalance(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
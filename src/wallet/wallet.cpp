@@ -12,6 +12,7 @@
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "validation.h"
@@ -21,6 +22,7 @@
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
@@ -167,9 +169,23 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
         nTimeFirstKey = metadata.nCreateTime;
 
     // update the chain model in the database
+    SetHDChainCounter(nAccountIndex, fInternal, nChildIndex);
+
+    if (!AddHDPubKey(childKey.Neuter(), fInternal))
+        throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
+}
+
+void CWallet::SetHDChainCounter(uint32_t nAccountIndex, bool fInternal, uint32_t nChildIndex)
+{
+    AssertLockHeld(cs_wallet);
+
     CHDChain hdChainCurrent;
     GetHDChain(hdChainCurrent);
 
+    CHDAccount acc;
+    if (!hdChainCurrent.GetAccount(nAccountIndex, acc))
+        throw std::runtime_error(std::string(__func__) + ": Wrong HD account!");
+
     if (fInternal) {
         acc.nInternalChainCounter = nChildIndex;
     }
@@ -188,9 +204,105 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
         if (!SetHDChain(hdChainCurrent, false))
             throw std::runtime_error(std::string(__func__) + ": SetHDChain failed");
     }
+}
 
-    if (!AddHDPubKey(childKey.Neuter(), fInternal))
-        throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
+bool CWallet::GetHDChainExtPubKey(uint32_t nAccountIndex, bool fInternal, CExtPubKey& extPubKeyRet)
+{
+    AssertLockHeld(cs_wallet);
+
+    CHDChain hdChainTmp;
+    if (!GetHDChain(hdChainTmp))
+        return false;
+
+    if (hdChainTmp.GetID() != hdChainExtPubKeysID) {
+        mapHDChainExtPubKeys.clear();
+        hdChainExtPubKeysID = hdChainTmp.GetID();
+    }
+
+    std::map<std::pair<uint32_t, bool>, CExtPubKey>::const_iterator it = mapHDChainExtPubKeys.find(std::make_pair(nAccountIndex, fInternal));
+    if (it != mapHDChainExtPubKeys.end()) {
+        extPubKeyRet = it->second;
+        return true;
+    }
+
+    if (!DecryptHDChain(hdChainTmp))
+        return false;
+    // make sure seed matches this chain
+    if (hdChainTmp.GetID() != hdChainTmp.GetSeedHash())
+        return false;
+
+    CExtKey chainKey;
+    hdChainTmp.DeriveChainExtKey(nAccountIndex, fInternal, chainKey);
+    extPubKeyRet = chainKey.Neuter();
+    mapHDChainExtPubKeys[std::make_pair(nAccountIndex, fInternal)] = extPubKeyRet;
+    return true;
+}
+
+//! Maximum number of threads deriving keypool keys
+static const int MAX_KEYPOOL_DERIVE_THREADS = 8;
+//! Fewest keys worth handing to a separate derivation thread
+static const size_t KEYPOOL_KEYS_PER_THREAD = 64;
+
+static void DeriveChildExtPubKeyRange(const CExtPubKey& chainKey, uint32_t nFirstChild, std::vector<CExtPubKey>& vKeys,
+                                      size_t nBegin, size_t nEnd, std::atomic<bool>& fFailed)
+{
+    for (size_t i = nBegin; i < nEnd && !fFailed; i++)
+        if (!chainKey.Derive(vKeys[i], nFirstChild + i))
+            fFailed = true;
+}
+
+/**
+ * Derive the non-hardened children nFirstChild.. of a chain key into vKeys,
+ * spread over several threads. Only public derivation is needed; private
+ * keys are derived on demand by GetKey.
+ */
+static bool DeriveChildExtPubKeys(const CExtPubKey& chainKey, uint32_t nFirstChild, std::vector<CExtPubKey>& vKeys)
+{
+    std::atomic<bool> fFailed(false);
+    size_t nThreads = std::max(1, std::min(GetNumCores(), MAX_KEYPOOL_DERIVE_THREADS));
+    nThreads = std::max((size_t)1, std::min(nThreads, vKeys.size() / KEYPOOL_KEYS_PER_THREAD));
+    if (nThreads == 1) {
+        DeriveChildExtPubKeyRange(chainKey, nFirstChild, vKeys, 0, vKeys.size(), fFailed);
+        return !fFailed;
+    }
+
+    boost::thread_group threadGroup;
+    size_t nChunk = (vKeys.size() + nThreads - 1) / nThreads;
+    for (size_t nBegin = 0; nBegin < vKeys.size(); nBegin += nChunk)
+        threadGroup.create_thread(boost::bind(&DeriveChildExtPubKeyRange, boost::cref(chainKey), nFirstChild, boost::ref(vKeys),
+                                              nBegin, std::min(nBegin + nChunk, vKeys.size()), boost::ref(fFailed)));
+    threadGroup.join_all();
+    return !fFailed;
+}
+
+uint32_t CWallet::DeriveNewChildPubKeys(uint32_t nAccountIndex, bool fInternal, unsigned int nCount, std::vector<CExtPubKey>& vExtPubKeysRet)
+{
+    AssertLockHeld(cs_wallet);
+
+    CExtPubKey chainKey;
+    if (!GetHDChainExtPubKey(nAccountIndex, fInternal, chainKey))
+        throw std::runtime_error(std::string(__func__) + ": GetHDChainExtPubKey failed");
+
+    CHDChain hdChainCurrent;
+    GetHDChain(hdChainCurrent);
+    CHDAccount acc;
+    if (!hdChainCurrent.GetAccount(nAccountIndex, acc))
+        throw std::runtime_error(std::string(__func__) + ": Wrong HD account!");
+
+    // derive children from the next index on, skip keys already known to the wallet
+    uint32_t nChildIndex = fInternal ? acc.nInternalChainCounter : acc.nExternalChainCounter;
+    vExtPubKeysRet.clear();
+    vExtPubKeysRet.reserve(nCount);
+    while (vExtPubKeysRet.size() < nCount) {
+        std::vector<CExtPubKey> vBatch(nCount - vExtPubKeysRet.size());
+        if (!DeriveChildExtPubKeys(chainKey, nChildIndex, vBatch))
+            throw std::runtime_error(std::string(__func__) + ": Derive failed");
+        nChildIndex += vBatch.size();
+        BOOST_FOREACH(const CExtPubKey& extPubKey, vBatch)
+            if (!HaveKey(extPubKey.pubkey.GetID()))
+                vExtPubKeysRet.push_back(extPubKey);
+    }
+    return nChildIndex;
 }
 
 bool CWallet::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
@@ -263,6 +375,7 @@ bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal)
     hdPubKey.hdchainID = hdChainCurrent.GetID();
     hdPubKey.nChangeIndex = fInternal ? 1 : 0;
     mapHdPubKeys[extPubKey.pubkey.GetID()] = hdPubKey;
+    fWalletUTXOStale = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -284,6 +397,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    fWalletUTXOStale = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -344,6 +458,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fWalletUTXOStale = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -369,6 +484,7 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    fWalletUTXOStale = true;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -692,6 +808,27 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+void CWallet::AddToWalletUTXO(const COutPoint& outpoint) const
+{
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    if (mi == mapWallet.end() || outpoint.n >= mi->second.vout.size())
+        return;
+    if (IsMine(mi->second.vout[outpoint.n]) && !IsSpent(outpoint.hash, outpoint.n))
+        setWalletUTXO.insert(outpoint);
+}
+
+void CWallet::RebuildWalletUTXOIfStale() const
+{
+    AssertLockHeld(cs_wallet);
+    if (!fWalletUTXOStale)
+        return;
+    fWalletUTXOStale = false;
+    setWalletUTXO.clear();
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (unsigned int i = 0; i < it->second.vout.size(); ++i)
+            AddToWalletUTXO(COutPoint(it->first, i));
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -871,6 +1008,18 @@ void CWallet::MarkDirty()
     fAnonymizableTallyCachedNonDenom = false;
 }
 
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    setBalanceDirty.insert(hash);
+}
+
+void CWalletTx::MarkBalanceDirty() const
+{
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -950,11 +1099,6 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                              wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
-            for(int i = 0; i < wtx.vout.size(); ++i) {
-                if (IsMine(wtx.vout[i]) && !IsSpent(hash, i)) {
-                    setWalletUTXO.insert(COutPoint(hash, i));
-                }
-            }
         }
 
         bool fUpdated = false;
@@ -984,6 +1128,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        // Index spendable outputs; an update (e.g. from a rescan after an
+        // import) can turn outputs of a known transaction into ours
+        for (unsigned int i = 0; i < wtx.vout.size(); ++i)
+            AddToWalletUTXO(COutPoint(hash, i));
+
+        // Outputs this transaction spends no longer count towards the balance
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            if (mapWallet.count(txin.prevout.hash))
+                MarkBalanceDirty(txin.prevout.hash);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1106,8 +1260,11 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    // The output is no longer spent by this transaction
+                    AddToWalletUTXO(txin.prevout);
+                }
             }
         }
     }
@@ -1170,8 +1327,11 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    // The output is no longer spent by this transaction
+                    AddToWalletUTXO(txin.prevout);
+                }
             }
         }
     }
@@ -1565,49 +1725,302 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+/** Maximum number of threads reading blocks for a rescan */
+static const int MAX_RESCAN_THREADS = 4;
+/** Number of blocks each rescan thread may read ahead of the committed height */
+static const int RESCAN_BLOCKS_PER_THREAD = 16;
+
+/**
+ * A snapshot of everything that can make a transaction relevant to the
+ * wallet. It matches a superset of what AddToWalletIfInvolvingMe accepts
+ * (multisig and P2SH outputs match on any known key or script), so it can
+ * be used to skip transactions without taking any lock.
+ */
+class CWalletScanFilter
+{
+public:
+    std::set<CKeyID> setKeys;
+    std::set<CScriptID> setScripts;
+    std::set<CScript> setWatchOnly;
+    std::set<uint256> setTxids; // wallet transactions, to catch updates and spends
+    std::set<COutPoint> setSpent; // outpoints wallet transactions spend, to catch conflicts
+
+    bool IsRelevant(const CTransaction& tx) const
+    {
+        if (setTxids.count(tx.GetHash()))
+            return true;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (setTxids.count(txin.prevout.hash) || setSpent.count(txin.prevout))
+                return true;
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+            if (IsRelevant(txout.scriptPubKey))
+                return true;
+        return false;
+    }
+
+private:
+    bool IsRelevant(const CScript& scriptPubKey) const
+    {
+        if (setWatchOnly.count(scriptPubKey))
+            return true;
+
+        std::vector<std::vector<unsigned char> > vSolutions;
+        txnouttype whichType;
+        if (!Solver(scriptPubKey, whichType, vSolutions))
+            return false;
+
+        switch (whichType)
+        {
+        case TX_PUBKEY:
+            return setKeys.count(CPubKey(vSolutions[0]).GetID()) > 0;
+        case TX_PUBKEYHASH:
+            return setKeys.count(CKeyID(uint160(vSolutions[0]))) > 0;
+        case TX_SCRIPTHASH:
+            return setScripts.count(CScriptID(uint160(vSolutions[0]))) > 0;
+        case TX_MULTISIG:
+            for (unsigned int i = 1; i + 1 < vSolutions.size(); i++)
+                if (setKeys.count(CPubKey(vSolutions[i]).GetID()))
+                    return true;
+            return false;
+        default:
+            return false;
+        }
+    }
+};
+
+void CWallet::BuildScanFilter(CWalletScanFilter& filter) const
+{
+    AssertLockHeld(cs_wallet);
+
+    GetKeys(filter.setKeys);
+    for (std::map<CKeyID, CHDPubKey>::const_iterator it = mapHdPubKeys.begin(); it != mapHdPubKeys.end(); ++it)
+        filter.setKeys.insert(it->first);
+    {
+        LOCK(cs_KeyStore);
+        for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+            filter.setScripts.insert(it->first);
+        filter.setWatchOnly = setWatchOnly;
+    }
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        filter.setTxids.insert(it->first);
+    for (TxSpends::const_iterator it = mapTxSpends.begin(); it != mapTxSpends.end(); ++it)
+        filter.setSpent.insert(it->first);
+}
+
+/** Sets a flag while in scope and clears it again, also when leaving by an exception */
+class CScopedFlag
+{
+private:
+    std::atomic<bool>& flag;
+
+public:
+    CScopedFlag(std::atomic<bool>& flagIn) : flag(flagIn) { flag = true; }
+    ~CScopedFlag() { flag = false; }
+};
+
+/**
+ * Reads the blocks of a rescan from disk on worker threads, without cs_main,
+ * and marks the transactions the filter lets through. Blocks are handed back
+ * in chain order; workers stay at most a fixed window ahead of the consumer.
+ */
+class CWalletScanQueue
+{
+public:
+    struct CScanResult {
+        CBlock block;
+        bool fRead;
+        std::vector<bool> vRelevant; // per transaction in block.vtx
+    };
+
+private:
+    const std::vector<CBlockIndex*>& vBlocks;
+    const CWalletScanFilter& filter;
+    const Consensus::Params& consensusParams;
+    size_t nWindow;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    size_t nNext;     // next block a worker will read
+    size_t nConsumed; // blocks handed back so far
+    std::map<size_t, boost::shared_ptr<CScanResult> > mapResults;
+    bool fStop;
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        RenameThread("futurocoin-rescan");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && nNext < vBlocks.size() && nNext >= nConsumed + nWindow)
+                    cond.wait(lock);
+                if (fStop || nNext >= vBlocks.size())
+                    return;
+                i = nNext++;
+            }
+
+            boost::shared_ptr<CScanResult> result(new CScanResult());
+            // Blocks of the active chain are not moved on disk, their position is safe to read
+            result->fRead = ReadBlockFromDisk(result->block, vBlocks[i], consensusParams);
+            if (result->fRead) {
+                result->vRelevant.reserve(result->block.vtx.size());
+                BOOST_FOREACH(const CTransaction& tx, result->block.vtx)
+                    result->vRelevant.push_back(filter.IsRelevant(tx));
+            }
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            mapResults[i] = result;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CWalletScanQueue(const std::vector<CBlockIndex*>& vBlocksIn, const CWalletScanFilter& filterIn, const Consensus::Params& consensusParamsIn, int nThreads) :
+        vBlocks(vBlocksIn), filter(filterIn), consensusParams(consensusParamsIn),
+        nWindow(nThreads * RESCAN_BLOCKS_PER_THREAD), nNext(0), nConsumed(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CWalletScanQueue::ThreadRead, this));
+    }
+
+    ~CWalletScanQueue()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup.join_all();
+    }
+
+    /** Wait for block i, which must be the next one in chain order */
+    boost::shared_ptr<CScanResult> Get(size_t i)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        assert(i == nConsumed);
+        while (!mapResults.count(i))
+            cond.wait(lock);
+        boost::shared_ptr<CScanResult> result = mapResults[i];
+        mapResults.erase(i);
+        nConsumed = i + 1;
+        cond.notify_all();
+        return result;
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and filtered in parallel without holding any lock;
+ * cs_main and cs_wallet are only taken to add the hits of a block.
+ * The scan stops early on shutdown or when AbortRescan() is called.
+ * ppindexScanned, if given, receives the last block the scan covered, or
+ * NULL if it was aborted before completing any block.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, CBlockIndex* pindexStop, CBlockIndex** ppindexScanned)
 {
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
-    CBlockIndex* pindex = pindexStart;
+    LOCK(cs_rescan);
+    fAbortRescan = false;
+    CScopedFlag scanning(fScanningWallet);
+
+    std::vector<CBlockIndex*> vBlocks;
+    CWalletScanFilter filter;
+    CBlockIndex* pindexScanned = NULL;
     {
         LOCK2(cs_main, cs_wallet);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
-        while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
+        CBlockIndex* pindex = pindexStart;
+        while (pindex && pindex != pindexStop && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        for (; pindex; pindex = chainActive.Next(pindex)) {
+            vBlocks.push_back(pindex);
+            if (pindex == pindexStop)
+                break;
+        }
+
+        // nothing to read, everything up to the stop block is covered already
+        if (vBlocks.empty())
+            pindexScanned = pindexStop ? pindexStop : chainActive.Tip();
+
+        BuildScanFilter(filter);
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    if (!vBlocks.empty()) {
+        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), vBlocks.front(), false);
+        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), vBlocks.back(), false);
+        int nThreads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS));
+        CWalletScanQueue queue(vBlocks, filter, chainParams.GetConsensus(), nThreads);
+
+        // Transactions that passed the filter during this scan and the outpoints
+        // they spend. The readers' filter predates the scan, so spends of and
+        // conflicts with these are only caught here.
+        std::set<uint256> setFound;
+        std::set<COutPoint> setFoundSpent;
+        pindexScanned = vBlocks.back();
+        for (size_t i = 0; i < vBlocks.size(); i++)
         {
+            CBlockIndex* pindex = vBlocks[i];
+            if (fAbortRescan || ShutdownRequested()) {
+                LogPrintf("Rescan aborted at block %d\n", pindex->nHeight);
+                pindexScanned = i > 0 ? vBlocks[i - 1] : NULL;
+                break;
+            }
+
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
+
+            boost::shared_ptr<CWalletScanQueue::CScanResult> result = queue.Get(i);
+            if (!result->fRead)
+                continue;
+
+            const CBlock& block = result->block;
+            std::vector<const CTransaction*> vHits;
+            for (size_t n = 0; n < block.vtx.size(); n++) {
+                const CTransaction& tx = block.vtx[n];
+                bool fRelevant = result->vRelevant[n];
+                for (size_t j = 0; !fRelevant && j < tx.vin.size(); j++)
+                    fRelevant = setFound.count(tx.vin[j].prevout.hash) > 0 || setFoundSpent.count(tx.vin[j].prevout) > 0;
+                if (fRelevant) {
+                    vHits.push_back(&tx);
+                    setFound.insert(tx.GetHash());
+                    if (!tx.IsCoinBase())
+                        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                            setFoundSpent.insert(txin.prevout);
+                }
+            }
+            if (vHits.empty())
+                continue;
+
+            LOCK2(cs_main, cs_wallet);
+            // A block disconnected in the meantime reaches the wallet through SyncTransaction
+            if (!chainActive.Contains(pindex))
+                continue;
+            BOOST_FOREACH(const CTransaction* ptx, vHits)
+            {
+                if (AddToWalletIfInvolvingMe(*ptx, &block, fUpdate))
+                    ret++;
+            }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+    if (ppindexScanned)
+        *ppindexScanned = pindexScanned;
     return ret;
 }
 
@@ -1988,110 +2401,115 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::RefreshBalances() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (pindexBalanceTip == NULL || !chainActive.Contains(pindexBalanceTip)) {
+        // First use or the chain was reorganized: recount everything
+        balancesTotal.SetNull();
+        mapBalanceContrib.clear();
+        setBalanceVolatile.clear();
+        setBalanceDirty.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+            setBalanceDirty.insert(it->first);
+    } else if (pindexBalanceTip != pindexTip || nBalanceMempoolUpdated != nMempoolUpdated) {
+        // Transactions entering or leaving the mempool change InMempool() and
+        // IsTrusted() of unconfirmed ones without the wallet being told
+        setBalanceDirty.insert(setBalanceVolatile.begin(), setBalanceVolatile.end());
     }
+    pindexBalanceTip = pindexTip;
+    nBalanceMempoolUpdated = nMempoolUpdated;
 
-    return nTotal;
-}
-
-CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
-{
-    CAmount nTotal = 0;
+    BOOST_FOREACH(const uint256& hash, setBalanceDirty)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
+        std::map<uint256, CWalletBalances>::iterator itContrib = mapBalanceContrib.find(hash);
+        if (itContrib != mapBalanceContrib.end()) {
+            balancesTotal -= itContrib->second;
+            mapBalanceContrib.erase(itContrib);
+        }
+        setBalanceVolatile.erase(hash);
 
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        const CWalletTx* pcoin = &(*it).second;
+
+        CWalletBalances contrib;
+        bool fTrusted = pcoin->IsTrusted();
+        if (fTrusted) {
+            contrib.nAvailable = pcoin->GetAvailableCredit();
+            contrib.nWatchOnlyAvailable = pcoin->GetAvailableWatchOnlyCredit();
+        } else if (pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool()) {
+            contrib.nUnconfirmed = pcoin->GetAvailableCredit();
+            contrib.nWatchOnlyUnconfirmed = pcoin->GetAvailableWatchOnlyCredit();
         }
+        contrib.nImmature = pcoin->GetImmatureCredit();
+        contrib.nWatchOnlyImmature = pcoin->GetImmatureWatchOnlyCredit();
+        contrib.nDenominatedConfirmed = pcoin->GetDenominatedCredit(false);
+        contrib.nDenominatedUnconfirmed = pcoin->GetDenominatedCredit(true);
+
+        balancesTotal += contrib;
+        mapBalanceContrib.insert(std::make_pair(hash, contrib));
+
+        // Anything not yet buried under a block, or not yet mature, may
+        // change its share when the tip moves without being marked dirty
+        if (pcoin->GetDepthInMainChain(false) < 1 || pcoin->GetBlocksToMaturity() > 0)
+            setBalanceVolatile.insert(hash);
     }
+    setBalanceDirty.clear();
+}
 
-    return nTotal;
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nAvailable;
+}
+
+CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
+{
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return unconfirmed ? balancesTotal.nDenominatedUnconfirmed : balancesTotal.nDenominatedConfirmed;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nWatchOnlyAvailable;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalances();
+    return balancesTotal.nWatchOnlyImmature;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, AvailableCoinsType nCoinType) const
@@ -2100,37 +2518,49 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        RebuildWalletUTXOIfStale();
+        // Only outputs in setWalletUTXO can be available, so walk those
+        // instead of the whole transaction history. Outputs of the same
+        // transaction are adjacent in the set.
+        std::set<COutPoint>::const_iterator it = setWalletUTXO.begin();
+        while (it != setWalletUTXO.end())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
-
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            const uint256 wtxid = it->hash;
+            std::set<COutPoint>::const_iterator itNextTx = setWalletUTXO.lower_bound(COutPoint(wtxid, std::numeric_limits<uint32_t>::max()));
 
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            // do not use IX for inputs that have less then INSTANTSEND_CONFIRMATIONS_REQUIRED blockchain confirmations
-            if (nDepth < INSTANTSEND_CONFIRMATIONS_REQUIRED)
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(wtxid);
+            if (mi == mapWallet.end()) {
+                it = itNextTx;
                 continue;
-
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
+            }
+            const CWalletTx* pcoin = &mi->second;
+
+            int nDepth = 0;
+            bool fUsable = CheckFinalTx(*pcoin) &&
+                           (!fOnlyConfirmed || pcoin->IsTrusted()) &&
+                           !(pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0);
+            if (fUsable) {
+                nDepth = pcoin->GetDepthInMainChain(false);
+                // do not use IX for inputs that have less then INSTANTSEND_CONFIRMATIONS_REQUIRED blockchain confirmations
+                // We should not consider coins which aren't at least in our mempool
+                // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                fUsable = nDepth >= INSTANTSEND_CONFIRMATIONS_REQUIRED && !(nDepth == 0 && !pcoin->InMempool());
+            }
+            if (!fUsable) {
+                it = itNextTx;
                 continue;
+            }
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            for (; it != itNextTx; ++it) {
+                unsigned int i = it->n;
+                if (i >= pcoin->vout.size())
+                    continue;
 
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) &&
+                    !IsLockedCoin(wtxid, i) &&
                     (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
@@ -2196,7 +2626,7 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -2209,10 +2639,16 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
+    // Shuffle pointers rather than copying the outputs themselves
+    vector<const COutput*> vCoinsShuffled;
+    vCoinsShuffled.reserve(vCoins.size());
     BOOST_FOREACH(const COutput &output, vCoins)
+        vCoinsShuffled.push_back(&output);
+    random_shuffle(vCoinsShuffled.begin(), vCoinsShuffled.end(), GetRandInt);
+
+    BOOST_FOREACH(const COutput *poutput, vCoinsShuffled)
     {
+        const COutput &output = *poutput;
         if (!output.fSpendable)
             continue;
 
@@ -2299,15 +2735,6 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-struct CompareByValue
-{
-    bool operator()(const COutput& t1,
-                    const COutput& t2) const
-    {
-        return t1.tx->vout[t1.i].nValue > t2.tx->vout[t2.i].nValue;
-    }
-};
-
 bool CWallet::SelectTheBiggestCoins(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
@@ -2339,6 +2766,101 @@ bool CWallet::SelectTheBiggestCoins(const CAmount& nTargetValue, int nConfMine,
     }
 }
 
+bool CWallet::SelectCoinsBnB(const CAmount& nTargetValue, const CAmount& nCostOfChange, int nConfMine, int nConfTheirs, const vector<COutput>& vCoinsSorted,
+                             set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    if (nTargetValue <= 0)
+        return false;
+
+    // Eligible coins, still in descending value order
+    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
+    CAmount nAvailable = 0;
+    BOOST_FOREACH(const COutput &output, vCoinsSorted)
+    {
+        if (!output.fSpendable)
+            continue;
+
+        const CWalletTx *pcoin = output.tx;
+        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            continue;
+
+        CAmount n = pcoin->vout[output.i].nValue;
+        if (n <= 0)
+            continue;
+        vValue.push_back(make_pair(n, make_pair(pcoin, output.i)));
+        nAvailable += n;
+    }
+
+    if (nAvailable < nTargetValue)
+        return false;
+
+    // Walk the inclusion/omission tree, largest coins first. vfCurrent is the
+    // stack of decisions taken so far; its size is the index of the next coin.
+    vector<char> vfCurrent;
+    vector<char> vfBest;
+    CAmount nCurrent = 0;
+    CAmount nBestExcess = std::numeric_limits<CAmount>::max();
+    size_t nTries = 0;
+    for (; nTries < MAX_BNB_TRIES; ++nTries)
+    {
+        bool fBacktrack = false;
+        if (nCurrent + nAvailable < nTargetValue || nCurrent > nTargetValue + nCostOfChange) {
+            // Cannot reach the target, or already overshot the window
+            fBacktrack = true;
+        } else if (nCurrent >= nTargetValue) {
+            if (nCurrent - nTargetValue < nBestExcess) {
+                nBestExcess = nCurrent - nTargetValue;
+                vfBest = vfCurrent;
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Undo trailing omissions, then turn the last inclusion into an omission
+            while (!vfCurrent.empty() && !vfCurrent.back()) {
+                vfCurrent.pop_back();
+                nAvailable += vValue[vfCurrent.size()].first;
+            }
+            if (vfCurrent.empty())
+                break;
+            vfCurrent.back() = false;
+            nCurrent -= vValue[vfCurrent.size() - 1].first;
+        } else {
+            const CAmount n = vValue[vfCurrent.size()].first;
+            nAvailable -= n;
+            // Including this coin after omitting an equal one would only
+            // revisit a branch that was already explored
+            if (!vfCurrent.empty() && !vfCurrent.back() && n == vValue[vfCurrent.size() - 1].first) {
+                vfCurrent.push_back(false);
+            } else {
+                vfCurrent.push_back(true);
+                nCurrent += n;
+            }
+        }
+    }
+
+    if (vfBest.empty())
+        return false;
+
+    for (unsigned int i = 0; i < vfBest.size(); i++)
+    {
+        if (vfBest[i])
+        {
+            setCoinsRet.insert(vValue[i].second);
+            nValueRet += vValue[i].first;
+        }
+    }
+    LogPrint("selectcoins", "CWallet::SelectCoinsBnB: %d coins, total %s, excess %s after %d tries\n",
+             setCoinsRet.size(), FormatMoney(nValueRet), FormatMoney(nBestExcess), nTries);
+
+    return true;
+}
+
 bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl,
                           AvailableCoinsType nCoinType, bool fChooseTheBiggestInputs) const
 {
@@ -2400,10 +2922,20 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             res = SelectTheBiggestCoins(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
                 SelectTheBiggestCoins(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet) ||
                 (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet));
-        else
-            res = SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-                SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-                (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet));
+        else {
+            // Look for a changeless match first: anything over the target
+            // that would only make dust change is given up as fee anyway
+            const CAmount nTarget = nTargetValue - nValueFromPresetInputs;
+            const CAmount nCostOfChange = CTxOut(0, CScript() << OP_DUP << OP_HASH160 << ToByteVector(uint160()) << OP_EQUALVERIFY << OP_CHECKSIG).GetDustThreshold(::minRelayTxFee) - 1;
+            vector<COutput> vCoinsSorted(vCoins);
+            sort(vCoinsSorted.begin(), vCoinsSorted.end(), CompareByValue());
+            res = SelectCoinsBnB(nTarget, nCostOfChange, 1, 6, vCoinsSorted, setCoinsRet, nValueRet) ||
+                SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoinsRet, nValueRet) ||
+                SelectCoinsBnB(nTarget, nCostOfChange, 1, 1, vCoinsSorted, setCoinsRet, nValueRet) ||
+                SelectCoinsMinConf(nTarget, 1, 1, vCoins, setCoinsRet, nValueRet) ||
+                (bSpendZeroConfChange && (SelectCoinsBnB(nTarget, nCostOfChange, 0, 1, vCoinsSorted, setCoinsRet, nValueRet) ||
+                                          SelectCoinsMinConf(nTarget, 0, 1, vCoins, setCoinsRet, nValueRet)));
+        }
     }
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
@@ -2492,6 +3024,7 @@ bool CWallet::SelectCoinsGrouppedByAddresses(std::vector<CompactTallyItem>& vecT
     // Tally
     map<CTxDestination, CompactTallyItem> mapTally;
     std::set<uint256> setWalletTxesCounted;
+    RebuildWalletUTXOIfStale();
     for (auto& outpoint : setWalletUTXO) {
 
         if (setWalletTxesCounted.find(outpoint.hash) != setWalletTxesCounted.end()) continue;
@@ -3118,13 +3651,8 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (auto& pair : mapWallet) {
-            for(int i = 0; i < pair.second.vout.size(); ++i) {
-                if (IsMine(pair.second.vout[i]) && !IsSpent(pair.first, i)) {
-                    setWalletUTXO.insert(COutPoint(pair.first, i));
-                }
-            }
-        }
+        fWalletUTXOStale = true;
+        RebuildWalletUTXOIfStale();
     }
 
     if (nLoadWalletRet != DB_LOAD_OK)
@@ -3287,8 +3815,100 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         } else {
             nTargetSize *= 2;
         }
-        bool fInternal = false;
         CWalletDB walletdb(strWalletFile);
+        if (IsHDEnabled())
+        {
+            // Derive each chain in one go and write all keys in a single
+            // database transaction; the chain counters are only advanced
+            // once the keys are safely on disk
+            // TODO: implement keypools for all accounts?
+            std::vector<CExtPubKey> vExtPubKeys[2];
+            uint32_t nNextChildIndex[2] = {0, 0};
+            if (missingExternal > 0)
+                nNextChildIndex[0] = DeriveNewChildPubKeys(0, false, missingExternal, vExtPubKeys[0]);
+            if (missingInternal > 0)
+                nNextChildIndex[1] = DeriveNewChildPubKeys(0, true, missingInternal, vExtPubKeys[1]);
+            if (vExtPubKeys[0].empty() && vExtPubKeys[1].empty())
+                return true;
+
+            int64_t nEnd = 1;
+            if (!setInternalKeyPool.empty())
+                nEnd = *(--setInternalKeyPool.end()) + 1;
+            if (!setExternalKeyPool.empty())
+                nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
+
+            CHDChain hdChainCurrent;
+            GetHDChain(hdChainCurrent);
+            CKeyMetadata metadata(GetTime());
+
+            std::vector<CHDPubKey> vHDPubKeys[2];
+            for (int nChain = 0; nChain < 2; nChain++)
+            {
+                vHDPubKeys[nChain].reserve(vExtPubKeys[nChain].size());
+                BOOST_FOREACH(const CExtPubKey& extPubKey, vExtPubKeys[nChain])
+                {
+                    CHDPubKey hdPubKey;
+                    hdPubKey.extPubKey = extPubKey;
+                    hdPubKey.hdchainID = hdChainCurrent.GetID();
+                    hdPubKey.nChangeIndex = nChain;
+                    vHDPubKeys[nChain].push_back(hdPubKey);
+                }
+            }
+
+            if (!walletdb.TxnBegin())
+                throw runtime_error("TopUpKeyPool(): TxnBegin failed");
+            int64_t nIndex = nEnd;
+            for (int nChain = 0; nChain < 2; nChain++)
+            {
+                BOOST_FOREACH(const CHDPubKey& hdPubKey, vHDPubKeys[nChain])
+                {
+                    if (!walletdb.WriteHDPubKey(hdPubKey, metadata) ||
+                        !walletdb.WritePool(nIndex++, CKeyPool(hdPubKey.extPubKey.pubkey, nChain == 1))) {
+                        walletdb.TxnAbort();
+                        throw runtime_error("TopUpKeyPool(): writing generated key failed");
+                    }
+                }
+            }
+            if (!walletdb.TxnCommit())
+                throw runtime_error("TopUpKeyPool(): TxnCommit failed");
+
+            nIndex = nEnd;
+            for (int nChain = 0; nChain < 2; nChain++)
+            {
+                bool fInternal = nChain == 1;
+                BOOST_FOREACH(const CHDPubKey& hdPubKey, vHDPubKeys[nChain])
+                {
+                    const CPubKey& pubkey = hdPubKey.extPubKey.pubkey;
+                    mapHdPubKeys[pubkey.GetID()] = hdPubKey;
+                    mapKeyMetadata[pubkey.GetID()] = metadata;
+
+                    // check if we need to remove from watch-only
+                    CScript script;
+                    script = GetScriptForDestination(pubkey.GetID());
+                    if (HaveWatchOnly(script))
+                        RemoveWatchOnly(script);
+                    script = GetScriptForRawPubKey(pubkey);
+                    if (HaveWatchOnly(script))
+                        RemoveWatchOnly(script);
+
+                    if (fInternal) {
+                        setInternalKeyPool.insert(nIndex++);
+                    } else {
+                        setExternalKeyPool.insert(nIndex++);
+                    }
+                }
+                if (!vHDPubKeys[nChain].empty())
+                    SetHDChainCounter(0, fInternal, nNextChildIndex[nChain]);
+            }
+            if (!nTimeFirstKey || metadata.nCreateTime < nTimeFirstKey)
+                nTimeFirstKey = metadata.nCreateTime;
+
+            LogPrintf("keypool added %u external and %u internal keys, size=%u\n", vHDPubKeys[0].size(), vHDPubKeys[1].size(),
+                      setInternalKeyPool.size() + setExternalKeyPool.size());
+            return true;
+        }
+
+        bool fInternal = false;
         for (int64_t i = missingInternal + missingExternal; i--;)
         {
             int64_t nEnd = 1;
@@ -3654,6 +4274,8 @@ bool CWallet::UpdatedTransaction(const uint256 &hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()){
+            // e.g. a completed InstantSend lock, which changes IsTrusted()
+            MarkBalanceDirty(hashTx);
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             return true;
         }
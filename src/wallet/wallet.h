@@ -20,6 +20,7 @@
 #include "wallet/walletdb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -61,6 +62,8 @@ static const CAmount DEFAULT_DIP0001_TRANSACTION_MINFEE = 1000;
 static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.2 * COIN; // "smallest denom" + X * "denom tails"
 //! minimum change amount
 static const CAmount MIN_CHANGE = CENT;
+//! Nodes branch-and-bound coin selection may explore before falling back to the knapsack solver
+static const size_t MAX_BNB_TRIES = 100000;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! -txconfirmtarget default
@@ -81,6 +84,7 @@ class CReserveKey;
 class CScript;
 class CTxMemPool;
 class CWalletTx;
+class CWalletScanFilter;
 
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
@@ -406,6 +410,9 @@ public:
         mapValue.erase("timesmart");
     }
 
+    //! queue this transaction's share of the wallet balance for a recount
+    void MarkBalanceDirty() const;
+
     //! make sure balances are recalculated
     void MarkDirty()
     {
@@ -421,6 +428,7 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        MarkBalanceDirty();
     }
 
     void BindWallet(CWallet *pwalletIn)
@@ -490,6 +498,16 @@ public:
     std::string ToString() const;
 };
 
+/** Orders outputs by value, largest first, as SelectCoinsBnB expects them */
+struct CompareByValue
+{
+    bool operator()(const COutput& t1,
+                    const COutput& t2) const
+    {
+        return t1.tx->vout[t1.i].nValue > t2.tx->vout[t2.i].nValue;
+    }
+};
+
 /** Private key that includes an expiration date in case it never gets used. */
 class CWalletKey
 {
@@ -598,6 +616,55 @@ private:
 };
 
 
+/** Wallet balance totals, or the share a single transaction contributes to them */
+struct CWalletBalances
+{
+    CAmount nAvailable;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnlyAvailable;
+    CAmount nWatchOnlyUnconfirmed;
+    CAmount nWatchOnlyImmature;
+    CAmount nDenominatedConfirmed;
+    CAmount nDenominatedUnconfirmed;
+
+    CWalletBalances() { SetNull(); }
+
+    void SetNull()
+    {
+        nAvailable = nUnconfirmed = nImmature = 0;
+        nWatchOnlyAvailable = nWatchOnlyUnconfirmed = nWatchOnlyImmature = 0;
+        nDenominatedConfirmed = nDenominatedUnconfirmed = 0;
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b)
+    {
+        nAvailable += b.nAvailable;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nWatchOnlyAvailable += b.nWatchOnlyAvailable;
+        nWatchOnlyUnconfirmed += b.nWatchOnlyUnconfirmed;
+        nWatchOnlyImmature += b.nWatchOnlyImmature;
+        nDenominatedConfirmed += b.nDenominatedConfirmed;
+        nDenominatedUnconfirmed += b.nDenominatedUnconfirmed;
+        return *this;
+    }
+
+    CWalletBalances& operator-=(const CWalletBalances& b)
+    {
+        nAvailable -= b.nAvailable;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nWatchOnlyAvailable -= b.nWatchOnlyAvailable;
+        nWatchOnlyUnconfirmed -= b.nWatchOnlyUnconfirmed;
+        nWatchOnlyImmature -= b.nWatchOnlyImmature;
+        nDenominatedConfirmed -= b.nDenominatedConfirmed;
+        nDenominatedUnconfirmed -= b.nDenominatedUnconfirmed;
+        return *this;
+    }
+};
+
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -640,7 +707,14 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
-    std::set<COutPoint> setWalletUTXO;
+    /* Outputs of wallet transactions that are ours and were unspent when last
+       looked at. Every available coin is in here; spentness is rechecked on use.
+       New keys, scripts or watch-only scripts can make known outputs ours, so
+       they mark the set stale and it is rebuilt from mapWallet on next use. */
+    mutable std::set<COutPoint> setWalletUTXO;
+    mutable bool fWalletUTXOStale;
+    void AddToWalletUTXO(const COutPoint& outpoint) const;
+    void RebuildWalletUTXOIfStale() const;
 
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
@@ -650,6 +724,42 @@ private:
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
+    /* Extended public keys of the HD account/change chains, cached so keypool
+       top-ups do not walk down from the seed for every key */
+    std::map<std::pair<uint32_t, bool>, CExtPubKey> mapHDChainExtPubKeys;
+    uint256 hdChainExtPubKeysID;
+    bool GetHDChainExtPubKey(uint32_t nAccountIndex, bool fInternal, CExtPubKey& extPubKeyRet);
+
+    /* HD derive nCount new child public keys (on internal or external chain),
+       skipping keys already known; returns the index following the last one */
+    uint32_t DeriveNewChildPubKeys(uint32_t nAccountIndex, bool fInternal, unsigned int nCount, std::vector<CExtPubKey>& vExtPubKeysRet);
+
+    /* Store the index of the next child key to derive on a chain */
+    void SetHDChainCounter(uint32_t nAccountIndex, bool fInternal, uint32_t nChildIndex);
+
+    /* Snapshot the keys, scripts and transactions a rescan has to look for */
+    void BuildScanFilter(CWalletScanFilter& filter) const;
+
+    /**
+     * Running balance totals. Each transaction's share is kept in
+     * mapBalanceContrib so it can be swapped out when the transaction is
+     * marked dirty. Shares of transactions that are unconfirmed or immature
+     * depend on the chain tip and the mempool and are refreshed whenever
+     * either of them changes; a tip that left the active chain forces a full
+     * recount.
+     */
+    mutable CWalletBalances balancesTotal;
+    mutable std::map<uint256, CWalletBalances> mapBalanceContrib;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalanceVolatile;
+    mutable const CBlockIndex* pindexBalanceTip;
+    mutable unsigned int nBalanceMempoolUpdated;
+    void RefreshBalances() const;
+
+    CCriticalSection cs_rescan; //! serializes rescans, taken before cs_main
+    std::atomic<bool> fAbortRescan;
+    std::atomic<bool> fScanningWallet;
+
 public:
     /*
      * Main wallet lock.
@@ -722,6 +832,11 @@ public:
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        fAbortRescan = false;
+        fScanningWallet = false;
+        pindexBalanceTip = NULL;
+        nBalanceMempoolUpdated = 0;
+        fWalletUTXOStale = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -761,7 +876,14 @@ public:
      * completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    /**
+     * Depth-first search for a set of coins worth between nTargetValue and
+     * nTargetValue + nCostOfChange, so that no change output is needed.
+     * vCoinsSorted must be sorted with CompareByValue. Gives up after
+     * MAX_BNB_TRIES steps and returns the closest match found so far, if any.
+     */
+    bool SelectCoinsBnB(const CAmount& nTargetValue, const CAmount& nCostOfChange, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoinsSorted, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
     bool SelectTheBiggestCoins(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool GetCollateralTxIn(CTxIn& txinRet, CAmount& nValueRet) const;
@@ -841,10 +963,19 @@ public:
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
 
     void MarkDirty();
+    //! Queue a transaction's balance contribution for recomputation
+    void MarkBalanceDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /**
+     * Scan the active chain from pindexStart up to pindexStop (or the tip
+     * if NULL). Must be called without cs_main and cs_wallet held.
+     */
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, CBlockIndex* pindexStop = NULL, CBlockIndex** ppindexScanned = NULL);
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() { return fAbortRescan; }
+    bool IsScanning() { return fScanningWallet; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
@@ -105,6 +105,8 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    StartZMQSender();
+
     return true;
 }
 
@@ -114,6 +116,8 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // The sender thread uses the sockets, stop it before closing them
+        StopZMQSender();
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -8,6 +8,10 @@
 #include "validation.h"
 #include "util.h"
 
+#include <deque>
+
+#include <boost/thread.hpp>
+
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
 static const char *MSG_HASHBLOCK  = "hashblock";
@@ -17,44 +21,141 @@ static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK = "rawtxlock";
 
-// Internal function to send multipart message
-static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
+/** A notification waiting for the sender thread */
+struct CZMQQueuedMessage
+{
+    CZMQAbstractPublishNotifier* notifier;
+    const char* command;
+    std::vector<unsigned char>* pdata; // NULL while a raw block is still only on disk
+    CDiskBlockPos pos;
+    uint32_t nSequence;
+};
+
+static boost::mutex csZMQQueue;
+static boost::condition_variable condZMQQueue;
+static boost::condition_variable condZMQSent;
+static std::deque<CZMQQueuedMessage> queueZMQ;
+static CZMQAbstractPublishNotifier* pZMQSending = NULL; // notifier of the message being published
+static CZMQSenderStats zmqSenderStats;
+static boost::thread threadZMQSender;
+static bool fZMQSenderRunning = false;
+static bool fZMQSenderStop = false;
+
+// Internal function to send one part of a multipart message, copying the data
+static int zmq_send_part(void *sock, const void* data, size_t size, int flags)
 {
-    va_list args;
-    va_start(args, size);
+    zmq_msg_t msg;
 
-    while (1)
+    int rc = zmq_msg_init_size(&msg, size);
+    if (rc != 0)
     {
-        zmq_msg_t msg;
+        zmqError("Unable to initialize ZMQ msg");
+        return -1;
+    }
 
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0)
-        {
-            zmqError("Unable to initialize ZMQ msg");
-            return -1;
-        }
+    memcpy(zmq_msg_data(&msg), data, size);
+
+    rc = zmq_msg_send(&msg, sock, flags);
+    if (rc == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return -1;
+    }
 
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
+    zmq_msg_close(&msg);
+    return 0;
+}
+
+// Called by zmq once it is done with a buffer handed over by Publish
+static void zmq_free_vector(void *data, void *hint)
+{
+    delete static_cast<std::vector<unsigned char>*>(hint);
+}
 
-        data = va_arg(args, const void*);
+static void ThreadZMQSender()
+{
+    RenameThread("futurocoin-zmq");
 
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1)
+    while (true)
+    {
+        CZMQQueuedMessage msg;
         {
-            zmqError("Unable to send ZMQ msg");
-            zmq_msg_close(&msg);
-            return -1;
+            boost::unique_lock<boost::mutex> lock(csZMQQueue);
+            while (queueZMQ.empty() && !fZMQSenderStop)
+                condZMQQueue.wait(lock);
+            if (queueZMQ.empty())
+                break;
+            msg = queueZMQ.front();
+            queueZMQ.pop_front();
+            pZMQSending = msg.notifier;
         }
 
-        zmq_msg_close(&msg);
+        bool fSent = false;
+        if (msg.notifier->HasFailed())
+        {
+            delete msg.pdata;
+            msg.pdata = NULL;
+        }
+        else if (!msg.pdata)
+        {
+            // The block was written by WriteBlockToDisk moments ago, copy its
+            // bytes as they are instead of deserializing and serializing it again.
+            msg.pdata = new std::vector<unsigned char>();
+            if (!ReadRawBlockFromDisk(*msg.pdata, msg.pos, Params().MessageStart()))
+            {
+                zmqError("Can't read block from disk");
+                delete msg.pdata;
+                msg.pdata = NULL;
+            }
+        }
+        if (msg.pdata)
+            fSent = msg.notifier->Publish(msg.command, msg.pdata, msg.nSequence);
+        if (!fSent)
+            msg.notifier->SetFailed();
+
+        boost::unique_lock<boost::mutex> lock(csZMQQueue);
+        if (fSent)
+            zmqSenderStats.nSent++;
+        else
+            zmqSenderStats.nFailed++;
+        pZMQSending = NULL;
+        condZMQSent.notify_all();
+    }
+}
 
-        if (!data)
-            break;
+void StartZMQSender()
+{
+    boost::unique_lock<boost::mutex> lock(csZMQQueue);
+    assert(!fZMQSenderRunning);
+    fZMQSenderStop = false;
+    fZMQSenderRunning = true;
+    threadZMQSender = boost::thread(&ThreadZMQSender);
+}
 
-        size = va_arg(args, size_t);
+void StopZMQSender()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csZMQQueue);
+        if (!fZMQSenderRunning)
+            return;
+        fZMQSenderStop = true;
+        condZMQQueue.notify_all();
     }
-    return 0;
+    threadZMQSender.join();
+
+    boost::unique_lock<boost::mutex> lock(csZMQQueue);
+    fZMQSenderRunning = false;
+    LogPrint("zmq", "zmq: Sender stopped, %u notifications sent, %u dropped, %u failed\n",
+        zmqSenderStats.nSent, zmqSenderStats.nDropped, zmqSenderStats.nFailed);
+}
+
+CZMQSenderStats GetZMQSenderStats()
+{
+    boost::unique_lock<boost::mutex> lock(csZMQQueue);
+    CZMQSenderStats stats = zmqSenderStats;
+    stats.nQueueSize = queueZMQ.size();
+    return stats;
 }
 
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
@@ -100,6 +201,25 @@ void CZMQAbstractPublishNotifier::Shutdown()
 {
     assert(psocket);
 
+    {
+        // The sender thread may be publishing on this socket, let it finish
+        // and forget whatever else is still queued for this notifier
+        boost::unique_lock<boost::mutex> lock(csZMQQueue);
+        while (pZMQSending == this)
+            condZMQSent.wait(lock);
+        for (std::deque<CZMQQueuedMessage>::iterator it = queueZMQ.begin(); it != queueZMQ.end(); )
+        {
+            if (it->notifier == this)
+            {
+                delete it->pdata;
+                it = queueZMQ.erase(it);
+                zmqSenderStats.nFailed++;
+            }
+            else
+                ++it;
+        }
+    }
+
     int count = mapPublishNotifiers.count(address);
 
     // remove this notifier from the list of publishers using this address
@@ -126,19 +246,87 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
+bool CZMQAbstractPublishNotifier::QueueMessage(const char *command, std::vector<unsigned char>* pdata, const CDiskBlockPos* pos)
+{
+    assert(psocket);
+
+    CZMQQueuedMessage msg;
+    msg.notifier = this;
+    msg.command = command;
+    msg.pdata = pdata;
+    if (pos)
+        msg.pos = *pos;
+    {
+        boost::unique_lock<boost::mutex> lock(csZMQQueue);
+        if (fFailed)
+        {
+            delete pdata;
+            return false;
+        }
+        // Dropped messages use up a sequence number too, so subscribers can see the gap
+        msg.nSequence = nSequence++;
+        if (fZMQSenderRunning && !fZMQSenderStop && queueZMQ.size() < MAX_ZMQ_QUEUE_SIZE) {
+            queueZMQ.push_back(msg);
+            zmqSenderStats.nQueued++;
+            condZMQQueue.notify_one();
+            return true;
+        }
+        zmqSenderStats.nDropped++;
+    }
+    LogPrint("zmq", "zmq: Send queue full, dropping %s notification\n", command);
+    delete pdata;
+    // A full queue is not a reason to shut this notifier down
+    return true;
+}
+
+void CZMQAbstractPublishNotifier::SetFailed()
+{
+    boost::unique_lock<boost::mutex> lock(csZMQQueue);
+    fFailed = true;
+}
+
 bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+{
+    const unsigned char* pch = (const unsigned char*)data;
+    return QueueMessage(command, new std::vector<unsigned char>(pch, pch + size), NULL);
+}
+
+bool CZMQAbstractPublishNotifier::SendRawBlock(const char *command, const CDiskBlockPos& pos)
+{
+    return QueueMessage(command, NULL, &pos);
+}
+
+bool CZMQAbstractPublishNotifier::Publish(const char *command, std::vector<unsigned char>* pdata, uint32_t nMsgSequence)
 {
     assert(psocket);
 
     /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
+    if (zmq_send_part(psocket, command, strlen(command), ZMQ_SNDMORE) == -1)
+    {
+        delete pdata;
+        return false;
+    }
+
+    // Hand the data buffer over to zmq instead of copying it
+    zmq_msg_t msg;
+    if (zmq_msg_init_data(&msg, pdata->empty() ? NULL : &(*pdata)[0], pdata->size(), zmq_free_vector, pdata) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        delete pdata;
+        return false;
+    }
+    if (zmq_msg_send(&msg, psocket, ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
         return false;
+    }
+    zmq_msg_close(&msg);
 
-    /* increment memory only sequence number after sending */
-    nSequence++;
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nMsgSequence);
+    if (zmq_send_part(psocket, msgseq, sizeof(uint32_t), 0) == -1)
+        return false;
 
     return true;
 }
@@ -177,21 +365,13 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+        pos = pindex->GetBlockPos();
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendRawBlock(MSG_RAWBLOCK, pos);
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
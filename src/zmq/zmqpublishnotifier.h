@@ -7,16 +7,49 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <stdint.h>
+#include <vector>
+
 class CBlockIndex;
+struct CDiskBlockPos;
+
+/** Maximum number of notifications waiting for the ZMQ sender thread */
+static const unsigned int MAX_ZMQ_QUEUE_SIZE = 1000;
+
+/** Counters of the ZMQ sender thread, see GetZMQSenderStats() */
+struct CZMQSenderStats
+{
+    uint64_t nQueued;   // notifications accepted into the queue
+    uint64_t nSent;     // notifications published
+    uint64_t nDropped;  // notifications dropped because the queue was full
+    uint64_t nFailed;   // notifications that could not be read or sent
+    size_t nQueueSize;  // notifications currently waiting
+
+    CZMQSenderStats() : nQueued(0), nSent(0), nDropped(0), nFailed(0), nQueueSize(0) {}
+};
+
+/**
+ * All publish notifiers hand their messages to a single sender thread, which
+ * owns every publish socket once started. Validation only pays for queueing.
+ */
+void StartZMQSender();
+/** Publish whatever is still queued, then stop the sender thread. */
+void StopZMQSender();
+CZMQSenderStats GetZMQSenderStats();
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
-    uint32_t nSequence; // upcounting per message sequence number
+    uint32_t nSequence; // upcounting per message sequence number, assigned when queueing
+    bool fFailed;       // a message could not be published, set by the sender thread
+
+    bool QueueMessage(const char *command, std::vector<unsigned char>* pdata, const CDiskBlockPos* pos);
 
 public:
 
-    /* send zmq multipart message
+    CZMQAbstractPublishNotifier() : nSequence(0), fFailed(false) { }
+
+    /* queue zmq multipart message for the sender thread
        parts:
           * command
           * data
@@ -24,6 +57,19 @@ public:
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
+    /* queue the raw bytes of the block stored at pos, which the sender
+       thread reads from the block files as they are, to be sent as data */
+    bool SendRawBlock(const char *command, const CDiskBlockPos& pos);
+
+    /* send zmq multipart message, taking ownership of *pdata; sender thread only */
+    bool Publish(const char *command, std::vector<unsigned char>* pdata, uint32_t nMsgSequence);
+
+    /* called by the sender thread when a message could not be published. The
+       remaining queued messages are dropped and the next notification returns
+       false, so the notifier gets shut down like a failed synchronous send. */
+    void SetFailed();
+    bool HasFailed() const { return fFailed; }
+
     bool Initialize(void *pcontext);
     void Shutdown();
 };